@@ -3,10 +3,28 @@
 #ifdef _DEBUG
 #include <cassert>
 #endif
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <source_location>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #define SQLITE_ENABLE_NORMALIZE
 #include "sqlite-amalgamation-3470200/sqlite3.h"
 #include "fms_error.h"
@@ -24,13 +42,169 @@
     X(mmap_size,    2147483648)  \
     X(page_size,    8192)        \
 
+// Pragmas that can be changed at runtime: name, C++ type
+// Applied in this order. locking_mode precedes journal_mode so WAL
+// is never entered while EXCLUSIVE, which would keep the lock.
+#define SQLITE_PRAGMA_SETTINGS(X) \
+    X(locking_mode, std::string)  \
+    X(journal_mode, std::string)  \
+    X(synchronous,  int)          \
+    X(busy_timeout, int)          \
+    X(cache_size,   sqlite3_int64)\
+    X(mmap_size,    sqlite3_int64)\
+    X(temp_store,   int)          \
+    X(foreign_keys, int)          \
+    X(query_only,   int)          \
+
+namespace sqlite {
+
+	// Error from a SQLite call with its result code.
+	// Construction copies at most the message and the SQL near the error.
+	// what() formats the fms::error text on first use.
+	// try { ... } catch (const sqlite::busy&) { retry } catch (const sqlite::exception& ex) { ex.code() ... }
+	class exception : public std::runtime_error {
+		int code_;          // extended result code
+		int offset_;        // byte offset of the error in near_, or -1
+		const char* errstr; // static message from sqlite3_errstr, or null if in message
+		std::string message;
+		std::string near_;
+		std::source_location loc;
+		mutable std::atomic<std::string*> text; // formatted by what()
+	public:
+		exception(int code, const char* mesg = nullptr, std::string_view near = {}, int offset = -1,
+			const std::source_location& loc = std::source_location::current())
+			: std::runtime_error(""), code_{ code }, offset_{ offset }, errstr{ sqlite3_errstr(code) },
+			  near_{ near }, loc{ loc }, text{ nullptr }
+		{
+			// connection messages are usually the static text for the code
+			if (mesg and std::strcmp(mesg, errstr) != 0) {
+				message = mesg;
+				errstr = nullptr;
+			}
+		}
+		exception(const exception& ex)
+			: std::runtime_error(ex), code_{ ex.code_ }, offset_{ ex.offset_ }, errstr{ ex.errstr },
+			  message{ ex.message }, near_{ ex.near_ }, loc{ ex.loc }, text{ nullptr }
+		{ }
+		exception& operator=(const exception& ex)
+		{
+			if (this != &ex) {
+				std::runtime_error::operator=(ex);
+				code_ = ex.code_;
+				offset_ = ex.offset_;
+				errstr = ex.errstr;
+				message = ex.message;
+				near_ = ex.near_;
+				loc = ex.loc;
+				delete text.exchange(nullptr);
+			}
+
+			return *this;
+		}
+		~exception()
+		{
+			delete text.load();
+		}
+
+		// Primary result code, e.g. SQLITE_BUSY.
+		int primary() const noexcept
+		{
+			return code_ & 0xFF;
+		}
+		// Extended result code, e.g. SQLITE_BUSY_SNAPSHOT.
+		int code() const noexcept
+		{
+			return code_;
+		}
+		// Byte offset of the error in the SQL, or -1.
+		int offset() const noexcept
+		{
+			return offset_;
+		}
+		// SQLite error message.
+		const char* errmsg() const noexcept
+		{
+			return errstr ? errstr : message.c_str();
+		}
+		std::string_view sql() const noexcept
+		{
+			return near_;
+		}
+
+		const char* what() const noexcept override
+		{
+			std::string* s = text.load(std::memory_order_acquire);
+			if (!s) {
+				try {
+					auto* t = new std::string(fms::error(errmsg(), loc).at(near_, offset_).what());
+					if (text.compare_exchange_strong(s, t, std::memory_order_acq_rel)) {
+						s = t;
+					}
+					else {
+						delete t; // another thread formatted it
+					}
+				}
+				catch (...) {
+					return errmsg();
+				}
+			}
+
+			return s->c_str();
+		}
+	};
+
+	// SQLITE_BUSY: another connection holds a conflicting lock. Safe to retry the transaction.
+	struct busy : exception {
+		using exception::exception;
+	};
+	// SQLITE_CONSTRAINT: UNIQUE, CHECK, NOT NULL, FOREIGN KEY, ...
+	struct constraint : exception {
+		using exception::exception;
+	};
+	// SQLITE_CORRUPT or SQLITE_NOTADB: the database file is damaged.
+	struct corrupt : exception {
+		using exception::exception;
+	};
+
+	// Throw the exception for code. If pdb is not null and its last error is code,
+	// use its extended code, message, and error offset.
+	[[noreturn]] inline void throw_error(int code, sqlite3* pdb = nullptr, std::string_view near = {}, const char* mesg = nullptr,
+		const std::source_location& loc = std::source_location::current())
+	{
+		int offset = -1;
+		// codes from this library, e.g. SQLITE_MISMATCH from bind_typed, are not the connection's error
+		if (const int ext = pdb ? sqlite3_extended_errcode(pdb) : SQLITE_OK; (ext & 0xFF) == (code & 0xFF)) {
+			code = ext;
+			if (!mesg) {
+				mesg = sqlite3_errmsg(pdb);
+			}
+			if (!near.empty()) {
+				offset = sqlite3_error_offset(pdb);
+			}
+		}
+
+		switch (code & 0xFF) {
+		case SQLITE_BUSY:
+			throw busy(code, mesg, near, offset, loc);
+		case SQLITE_CONSTRAINT:
+			throw constraint(code, mesg, near, offset, loc);
+		case SQLITE_CORRUPT:
+		case SQLITE_NOTADB:
+			throw corrupt(code, mesg, near, offset, loc);
+		default:
+			throw exception(code, mesg, near, offset, loc);
+		}
+	}
+
+} // namespace sqlite
+
 // call OP and throw on error
 #define FMS_SQLITE_ERRMSG(DB, OP) { int __ret__ = OP; if (SQLITE_OK != __ret__) { \
-		throw std::runtime_error(fms::error(sqlite3_errmsg(DB)).what()); } }
+		sqlite::throw_error(__ret__, DB); } }
 
 // TODO: evaluate to __ret__?
 #define FMS_SQLITE_ERRSTR(OP) if (int __ret__ = (OP); __ret__ != SQLITE_OK) { \
-		throw std::runtime_error(fms::error(sqlite3_errstr(__ret__)).what()); }
+		sqlite::throw_error(__ret__); }
 
 // Fundamental SQLite type, SQL name, C type
 #define SQLITE_TYPE_ENUM(X)  \
@@ -165,6 +339,111 @@ namespace sqlite {
 		return quote(var, '\'', '\'');
 	}
 
+	// String literal usable as a template argument.
+	template<size_t N>
+	struct fixed_string {
+		char str[N];
+
+		constexpr fixed_string(const char(&s)[N])
+		{
+			std::copy_n(s, N, str);
+		}
+		constexpr std::string_view view() const
+		{
+			return std::string_view(str, N - 1);
+		}
+	};
+
+	// Offset and length of the first parameter at or after off, skipping
+	// string literals, quoted identifiers, and comments. Length 0 if none.
+	// https://sqlite.org/lang_expr.html#parameters
+	constexpr std::pair<size_t, size_t> next_parameter(const std::string_view& sql, size_t off = 0)
+	{
+		auto is_name = [](char c) {
+			return c == '_' or ('0' <= c and c <= '9') or ('a' <= c and c <= 'z') or ('A' <= c and c <= 'Z')
+				or static_cast<unsigned char>(c) >= 0x80;
+		};
+		auto skip = [&sql](size_t i, char r) {
+			i = sql.find(r, i + 1);
+			return i == std::string_view::npos ? sql.size() : i + 1;
+		};
+
+		size_t i = off;
+		while (i < sql.size()) {
+			const char c = sql[i];
+			if (c == '\'' or c == '"' or c == '`') {
+				i = skip(i, c);
+			}
+			else if (c == '[') {
+				i = skip(i, ']');
+			}
+			else if (c == '-' and i + 1 < sql.size() and sql[i + 1] == '-') {
+				i = skip(i, '\n');
+			}
+			else if (c == '/' and i + 1 < sql.size() and sql[i + 1] == '*') {
+				i = sql.find("*/", i + 2);
+				i = i == std::string_view::npos ? sql.size() : i + 2;
+			}
+			else if (c == '?' or c == ':' or c == '@' or c == '$') {
+				size_t j = i + 1;
+				while (j < sql.size() and is_name(sql[j])) {
+					++j;
+				}
+				return { i, j - i };
+			}
+			else {
+				++i;
+			}
+		}
+
+		return { sql.size(), 0 };
+	}
+	// Number of parameters in sql: the largest parameter index.
+	// https://sqlite.org/c3ref/bind_parameter_count.html
+	constexpr int parameter_count(const std::string_view& sql)
+	{
+		int n = 0;
+
+		for (auto [i, len] = next_parameter(sql); len; std::tie(i, len) = next_parameter(sql, i + len)) {
+			const auto p = sql.substr(i, len);
+			if (p[0] == '?') {
+				if (len == 1) {
+					++n;
+				}
+				else { // ?NNN
+					int nnn = 0;
+					for (char c : p.substr(1)) {
+						nnn = 10 * nnn + (c - '0');
+					}
+					n = std::max(n, nnn);
+				}
+			}
+			else {
+				// named parameters are numbered on first use
+				bool seen = false;
+				for (auto [k, l] = next_parameter(sql); k < i; std::tie(k, l) = next_parameter(sql, k + l)) {
+					if (sql.substr(k, l) == p) {
+						seen = true;
+						break;
+					}
+				}
+				if (!seen) {
+					++n;
+				}
+			}
+		}
+
+		return n;
+	}
+#ifdef _DEBUG
+	static_assert(parameter_count("SELECT 1") == 0);
+	static_assert(parameter_count("INSERT INTO t VALUES (?, ?, ?)") == 3);
+	static_assert(parameter_count("INSERT INTO t VALUES (?2, ?1)") == 2);
+	static_assert(parameter_count("SELECT :a, @b, $c, :a") == 3);
+	static_assert(parameter_count("SELECT '?', \"?\", [?], ? -- ?") == 1);
+	static_assert(parameter_count("SELECT /* :a */ ?") == 1);
+#endif // _DEBUG
+
 	// sqlite datetime
 	struct datetime {
 		union {
@@ -310,329 +589,247 @@ namespace sqlite {
 		}
 	};
 
-	// RAII class for sqlite3* database handle.
-	class db {
-		sqlite3* pdb;
-	public:
-		char* perrmsg; // might not be the same as sqlite3_errmsg()
-
-		db()
-			: pdb(nullptr), perrmsg(nullptr)
-		{
+	// Convertible to anything. Used to count aggregate members.
+	struct any_member {
+		template<class T>
+		operator T() const;
+	};
+	// Number of members of an aggregate S.
+	template<class S, class... A>
+	constexpr size_t aggregate_size()
+	{
+		if constexpr (requires { S{ std::declval<A>()..., any_member{} }; }) {
+			return aggregate_size<S, A..., any_member>();
 		}
-		// db("") for in-memory database
-		db(const char* filename = "", int flags = 0, const char* zVfs = nullptr)
-			: pdb(nullptr)
-		{
-			open(filename, flags, zVfs);
+		else {
+			return sizeof...(A);
 		}
-		// so ~db is called only once
-		db(const db&) = delete;
-		db& operator=(const db&) = delete;
-		// https://sqlite.org/c3ref/close.html
-		~db()
-		{
-			close();
+	}
+	// Tuple of references to the members of an aggregate with at most 16 members.
+	template<class S>
+	constexpr auto tie_members(S& s)
+	{
+		constexpr size_t N = aggregate_size<S>();
+		if constexpr (N == 1) {
+			auto& [m1] = s;
+			return std::tie(m1);
 		}
-
-		// For use in the sqlite C API.
-		operator sqlite3* ()
-		{
-			return pdb;
+		else if constexpr (N == 2) {
+			auto& [m1, m2] = s;
+			return std::tie(m1, m2);
 		}
-
-		bool operator==(const db& db) const
-		{
-			return pdb == db.pdb;
+		else if constexpr (N == 3) {
+			auto& [m1, m2, m3] = s;
+			return std::tie(m1, m2, m3);
 		}
-
-		// https://sqlite.org/c3ref/open.html
-		db& open(const char* filename, int flags = 0, const char* zVfs = nullptr)
-		{
-			if (!flags) {
-				flags = (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
-			}
-			if (!filename || !*filename) {
-				flags |= SQLITE_OPEN_MEMORY;
-			}
-
-			FMS_SQLITE_ERRSTR(sqlite3_open_v2(filename, &pdb, flags, zVfs));
-
-			return *this;
+		else if constexpr (N == 4) {
+			auto& [m1, m2, m3, m4] = s;
+			return std::tie(m1, m2, m3, m4);
 		}
-		// Default encoding will be UTF-16 in the native byte order.
-		db& open(const wchar_t* filename)
-		{
-			FMS_SQLITE_ERRSTR(sqlite3_open16(filename, &pdb));
-
-			return *this;
+		else if constexpr (N == 5) {
+			auto& [m1, m2, m3, m4, m5] = s;
+			return std::tie(m1, m2, m3, m4, m5);
 		}
-		db& close()
-		{
-			if (perrmsg) {
-				sqlite3_free(perrmsg);
-				perrmsg = nullptr;
-			}
-			sqlite3_close(pdb);
-			pdb = nullptr;
-
-			return *this;
+		else if constexpr (N == 6) {
+			auto& [m1, m2, m3, m4, m5, m6] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6);
 		}
-		// PRAGMA key = value;
-		template<class T>
-		int pragma(const std::string_view& key, const T& value)
-		{
-			return exec(std::format("PRAGMA {} = {};", key, value).c_str());
+		else if constexpr (N == 7) {
+			auto& [m1, m2, m3, m4, m5, m6, m7] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7);
 		}
-		int default_pragmas()
-		{
-			int ret = SQLITE_OK;
-#define SQLITE_DEFAULT_PRAGMA(a, b) ret = pragma(#a, #b); if (ret != SQLITE_OK) return ret;
-			SQLITE_DEFAULTS(SQLITE_DEFAULT_PRAGMA)
-#undef SQLITE_DEFAULT_PRAGMA
-			return ret;
+		else if constexpr (N == 8) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8);
 		}
-		// Run zero or more UTF-8 encoded, semicolon-separate SQL statements.
-		// https://sqlite.org/c3ref/exec.html
-		using callback = int (*)(void* data, int col, char** text, char** name);
-		int exec(const char* sql, callback cb = nullptr, void* data = nullptr)
-		{
-			if (perrmsg) {
-				sqlite3_free(perrmsg);
-				perrmsg = nullptr;
-			}
-			int ret = sqlite3_exec(pdb, sql, cb, data, &perrmsg);
-			if (ret != SQLITE_OK) {
-				const auto err = fms::error(perrmsg).at(sql, sqlite3_error_offset(pdb));
-				throw std::runtime_error(err.what());
-			}
-
-			return ret;
+		else if constexpr (N == 9) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9);
 		}
-
-		// https://sqlite.org/c3ref/errcode.html
-		int errcode() const
-		{
-			return sqlite3_errcode(pdb);
+		else if constexpr (N == 10) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10);
 		}
-		int extended_errcode() const
-		{
-			return sqlite3_extended_errcode(pdb);
+		else if constexpr (N == 11) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11);
 		}
-		const char* errmsg() const
-		{
-			return sqlite3_errmsg(pdb);
+		else if constexpr (N == 12) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12);
 		}
-		const void* errmsg16() const
-		{
-			return sqlite3_errmsg16(pdb);
+		else if constexpr (N == 13) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13);
 		}
-		static const char* errstr(int i)
-		{
-			return sqlite3_errstr(i);
+		else if constexpr (N == 14) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14);
 		}
-		int error_offset() const
-		{
-			return sqlite3_error_offset(pdb);
+		else if constexpr (N == 15) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15);
 		}
+		else if constexpr (N == 16) {
+			auto& [m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15, m16] = s;
+			return std::tie(m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15, m16);
+		}
+		else {
+			static_assert(N <= 16, "sqlite::tie_members: too many members");
+		}
+	}
 
+	// Column metadata that does not change from row to row.
+	struct column_info {
+		std::string name;  // https://sqlite.org/c3ref/column_name.html
+		std::string decl;  // declared type, empty for expressions
+		int affinity;      // affinity of decl
+		int type;          // fundamental type of decl, SQLITE_UNKNOWN for expressions
+		int extended_type; // extended type of decl, SQLITE_UNKNOWN for expressions
+		// Source of the column if SQLITE_ENABLE_COLUMN_METADATA is defined, otherwise empty.
+		// https://sqlite.org/c3ref/column_database_name.html
+		std::string table;
+		std::string origin;
 	};
 
-	/*
-		bool operator==(const values&) const = default;
-
+	// Struct-of-arrays result buffers filled by stmt::fetch_batch.
+	// Buffers keep their capacity between fetches.
+	struct batch {
+		struct column {
+			int type = SQLITE_NULL;             // SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, or SQLITE_BLOB
+			std::vector<sqlite3_int64> integer; // SQLITE_INTEGER values
+			std::vector<double> real;           // SQLITE_FLOAT values
+			std::vector<int64_t> offset;        // SQLITE_TEXT or SQLITE_BLOB, rows + 1 offsets into arena
+			std::string arena;                  // SQLITE_TEXT or SQLITE_BLOB bytes
+			std::vector<uint8_t> valid;         // bit i of valid[i/8] is 0 if row i is NULL
+			size_t nulls = 0;
+
+			bool is_null(size_t i) const
+			{
+				return !(valid[i / 8] & (1u << (i % 8)));
+			}
+			std::string_view text(size_t i) const
+			{
+				return std::string_view(arena.data() + offset[i], offset[i + 1] - offset[i]);
+			}
+		};
+		std::vector<column> cols;
+		size_t rows = 0;
 
-#ifdef _DEBUG
-		static int test() {
-			sqlite::db db("");
+		const column& operator[](int j) const
+		{
+			return cols[j];
+		}
+		void clear()
+		{
+			cols.clear();
+			rows = 0;
+		}
+	};
 
-			auto exec = [&db](const char* sql) {
-				return sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
-				};
-			auto prepare = [&db](sqlite3_stmt** pstmt, const char* sql) {
-				return sqlite3_prepare(db, sql, -1, pstmt, 0);
-				};
+	// RAII for sqlite3_stmt*
+	class stmt {
+		sqlite3_stmt* pstmt;
+		const char* ptail;
+		int ret;
 
-			try {
-				{
-					sqlite3_stmt* pstmt = nullptr;
-					assert(SQLITE_OK == exec("DROP TABLE IF EXISTS t"));
-					assert(SQLITE_OK == exec("CREATE TABLE t (a)"));
-					assert(SQLITE_OK == prepare(&pstmt, "INSERT INTO t VALUES(?)"));
-					values vs(pstmt);
-					vs.bind(1); // null
-					assert(SQLITE_DONE == sqlite3_step(vs));
-					sqlite3_finalize(pstmt);
-
-					assert(SQLITE_OK == prepare(&pstmt, "SELECT * FROM t"));
-					assert(SQLITE_ROW == sqlite3_step(pstmt));
-					vs = values(pstmt);
-					//auto val = vs.value(0);
-					assert(1 == sqlite3_column_count(pstmt));
-					// assert(SQLITE_NULL == vs.type(0)); // null value???
-					assert(SQLITE_DONE == sqlite3_step(pstmt));
-					sqlite3_finalize(pstmt);
+		// Column and parameter indices for a name.
+		struct name_index {
+			int column = -1;   // 0-based, -1 if not a column
+			int parameter = 0; // 1-based, 0 if not a parameter
+		};
+		// Allow lookup by std::string_view without constructing a std::string.
+		struct name_hash {
+			using is_transparent = void;
+			size_t operator()(const std::string_view& name) const noexcept
+			{
+				return std::hash<std::string_view>{}(name);
+			}
+		};
+		// Built on the first lookup by name after prepare.
+		mutable std::unordered_map<std::string, name_index, name_hash, std::equal_to<>> names;
+		mutable bool named = false;
+		// Built on the first call for column metadata after prepare.
+		mutable std::vector<column_info> info;
+		mutable bool described = false;
+
+		const name_index* find_name(const std::string_view& name) const
+		{
+			if (!named) {
+				names.clear();
+				for (int j = 0; j < column_count(); ++j) {
+					auto& i = names[column_name(j)];
+					if (i.column == -1) {
+						i.column = j; // first column wins for duplicate names
+					}
 				}
-				{
-					sqlite3_stmt* pstmt = nullptr;
-					assert(SQLITE_OK == exec("DROP TABLE IF EXISTS t"));
-					assert(SQLITE_OK == exec("CREATE TABLE t (a REAL)"));
-					assert(SQLITE_OK == prepare(&pstmt, "INSERT INTO t VALUES(?)"));
-					values vs(pstmt);
-					vs.bind(1, 1.23);
-					assert(SQLITE_DONE == sqlite3_step(vs));
-					sqlite3_finalize(pstmt);
-
-					assert(SQLITE_OK == prepare(&pstmt, "SELECT * FROM t"));
-					values vs2(pstmt);
-					assert(SQLITE_ROW == sqlite3_step(pstmt));
-					assert(1 == sqlite3_column_count(pstmt));
-					int type = sqlite3_column_type(pstmt, 0);
-					assert(type == vs2.column_type(0));
-					assert(sqlite3_column_double(pstmt, 0) == 1.23);
-					assert(vs2.column_double(0) == 1.23);
-					assert(SQLITE_DONE == sqlite3_step(pstmt));
-					sqlite3_finalize(pstmt);
+				for (int i = 1; i <= bind_parameter_count(); ++i) {
+					if (const char* p = sqlite3_bind_parameter_name(pstmt, i)) {
+						names[p].parameter = i;
+					}
 				}
+				named = true;
 			}
-			catch (const std::exception& ex) {
-				std::cerr << ex.what() << '\n';
-			}
+			const auto i = names.find(name);
 
-			return 0;
+			return i == names.end() ? nullptr : &i->second;
 		}
-#endif // _DEBUG
-	};
-	*/
-	/*
-	// Forward iterator over columns of a row.
-	class stmt_iterable {
-		stmt vs;
-		int i; // current index
-		int e; // number of columns
 	public:
-		using iterator_category = std::forward_iterator_tag;
-		using value_type = value;
-		using pointer = value_type*;
-		using const_pointer = const value_type*;
-		using reference = value_type&;
-		using const_reference = const value_type&;
-		using difference_type = std::ptrdiff_t;
-
-		stmt_iterable(sqlite3_stmt* pstmt, int i = 0)
-			: vs{ pstmt }, i{ i }, e{ vs.column_count() }
+		stmt()
+			: pstmt{ nullptr }, ptail{ nullptr }, ret{ SQLITE_OK }
+		{ }
+		stmt(sqlite3* pdb)
+			: pstmt{ nullptr }, ptail{ nullptr }, ret{ SQLITE_OK }
 		{
+			// store pdb in stmt
+			FMS_SQLITE_ERRMSG(pdb, sqlite3_prepare_v2(pdb, "SELECT 0", 8, &pstmt, &ptail));
 		}
-		stmt_iterable(const values& vs, int i = 0)
-			: vs{ vs }, i{ i }, e{ vs.column_count() }
+		// Take ownership of a prepared statement.
+		explicit stmt(sqlite3_stmt* pstmt) noexcept
+			: pstmt{ pstmt }, ptail{ nullptr }, ret{ SQLITE_OK }
+		{ }
+		stmt(const stmt&) = delete;
+		stmt(stmt&& _stmt) = delete;
+		stmt& operator=(const stmt&) = delete;
+		stmt& operator=(stmt&& _stmt) = delete;
+		~stmt()
 		{
+			sqlite3_finalize(pstmt);
 		}
-		stmt_iterable(const stmt_iterable&) = default;
-		stmt_iterable& operator=(const stmt_iterable&) = default;
-		~stmt_iterable()
+
+		bool operator==(const stmt& stmt) const
 		{
+			return pstmt == stmt.pstmt;
 		}
 
-		bool operator==(const stmt_iterable&) const = default;
-
-		int sqltype() const
+		sqlite3* db_handle() const
 		{
-			return vs.sqltype(i);
+			return sqlite3_db_handle(pstmt);
 		}
-		int size() const
+
+		// Give up ownership without finalizing.
+		sqlite3_stmt* release() noexcept
 		{
-			return e;
+			return std::exchange(pstmt, nullptr);
 		}
 
-		// STL friendly
-		stmt_iterable begin() const
+		const char* tail() const
 		{
-			return stmt_iterable(vs, 0);
+			return ptail;
 		}
-		stmt_iterable end() const
+		int last() const
 		{
-			return stmt_iterable(vs, e);
+			return ret;
 		}
 
-		// iterable
-		explicit operator bool() const
+		// For use in native sqlite3 C functions.
+		operator sqlite3_stmt* () const noexcept
 		{
-			return 0 <= i and i < e;
+			return pstmt;
 		}
-		value_type operator*()
-		{
-			return value(vs, i);
-		}
-		stmt_iterable& operator++()
-		{
-			if (operator bool()) {
-				++i;
-			}
-
-			return *this;
-		}
-		stmt_iterable operator++(int)
-		{
-			auto _this = *this;
-
-			operator++();
-
-			return _this;
-		}
-
-	};
-	*/
-	// RAII for sqlite3_stmt*
-	class stmt {
-		sqlite3_stmt* pstmt;
-		const char* ptail;
-		int ret;
-	public:
-		stmt()
-			: pstmt{ nullptr }, ptail{ nullptr }, ret{ SQLITE_OK }
-		{ }
-		stmt(sqlite3* pdb)
-			: pstmt{ nullptr }, ptail{ nullptr }, ret{ SQLITE_OK }
-		{
-			// store pdb in stmt
-			FMS_SQLITE_ERRSTR(sqlite3_prepare_v2(pdb, "SELECT 0", 8, &pstmt, &ptail));
-		}
-		stmt(const stmt&) = delete;
-		stmt(stmt&& _stmt) = delete;
-		stmt& operator=(const stmt&) = delete;
-		stmt& operator=(stmt&& _stmt) = delete;
-		~stmt()
-		{
-			sqlite3_finalize(pstmt);
-		}
-
-		bool operator==(const stmt& stmt) const
-		{
-			return pstmt == stmt.pstmt;
-		}
-
-		sqlite3* db_handle() const
-		{
-			return sqlite3_db_handle(pstmt);
-		}
-
-		const char* tail() const
-		{
-			return ptail;
-		}
-		int last() const
-		{
-			return ret;
-		}
-
-		// For use in native sqlite3 C functions.
-		operator sqlite3_stmt* () const noexcept
-		{
-			return pstmt;
-		}
-
-		// https://www.sqlite.org/c3ref/expanded_sql.html
-		const char* sql() const
+
+		// https://www.sqlite.org/c3ref/expanded_sql.html
+		const char* sql() const
 		{
 			return sqlite3_sql(pstmt);
 		}
@@ -655,19 +852,27 @@ namespace sqlite {
 
 		// Compile a SQL statement: https://www.sqlite.org/c3ref/prepare.html
 		// SQL As Understood By SQLite: https://www.sqlite.org/lang.html
-		int prepare(const char* sql, int size = -1)
+		// Use SQLITE_PREPARE_PERSISTENT for statements that will be reused many times.
+		// https://sqlite.org/c3ref/c_prepare_dont_log.html
+		// No defaults so prepare(sql, flags) calls the overload below instead of taking flags as size.
+		int prepare(const char* sql, int size, unsigned int flags)
 		{
 			sqlite3* pdb = db_handle();
 			if (pdb) FMS_SQLITE_ERRMSG(pdb, sqlite3_finalize(pstmt));
-			FMS_SQLITE_ERRMSG(pdb, sqlite3_prepare_v2(pdb, sql, size, &pstmt, &ptail));
+			named = false;
+			described = false;
+			ret = SQLITE_OK; // not done, fetch_batch steps the new statement
+			if (int rc = sqlite3_prepare_v3(pdb, sql, size, flags, &pstmt, &ptail); rc != SQLITE_OK) {
+				throw_error(rc, pdb, size < 0 ? std::string_view(sql) : std::string_view(sql, size));
+			}
 
 			return SQLITE_OK;
 		}
-		int prepare(const std::string_view& sv)
+		// No copy is made. The tail points into sv.
+		// stmt.prepare(sql, SQLITE_PREPARE_PERSISTENT);
+		int prepare(const std::string_view& sv, unsigned int flags = 0)
 		{
-			std::string s = std::string(sv);
-			// include null terminator
-			return prepare(s.c_str(), 1 + static_cast<int>(s.size()));
+			return prepare(sv.data(), static_cast<int>(sv.size()), flags);
 		}
 		// int ret = stmt.step();  while (ret == SQLITE_ROW) { ...; ret = stmt.step()) { }
 		// if (ret != SQLITE_DONE) then error
@@ -677,7 +882,7 @@ namespace sqlite {
 			ret = sqlite3_step(pstmt);
 
 			if (ret != SQLITE_ROW and ret != SQLITE_DONE) {
-				throw std::runtime_error(fms::error(sqlite3_errstr(ret)).what());
+				throw_error(ret, db_handle());
 			}
 
 			return ret;
@@ -686,7 +891,10 @@ namespace sqlite {
 		// https://sqlite.org/c3ref/reset.html
 		int reset()
 		{
-			return ret = sqlite3_reset(pstmt);
+			const int rc = sqlite3_reset(pstmt);
+			ret = SQLITE_OK;
+
+			return rc;
 		}
 		// Reset bindings to NULL.
 		// https://www.sqlite.org/c3ref/clear_bindings.html
@@ -801,8 +1009,7 @@ namespace sqlite {
 			}
 			stmt& operator=(const std::wstring_view& str)
 			{
-				std::wstring s(str);	
-				return operator=(s.data());
+				return s.bind(i + 1, str);
 			}
 			const void* column_text16() const
 			{
@@ -865,12 +1072,12 @@ namespace sqlite {
 		{
 			return proxy(*this, i);
 		}
-		// name based column
-		proxy operator[](const char* name)
+		// name based column, or parameter if name starts with one of :@$
+		proxy operator[](const std::string_view& name)
 		{
 			int i = -1;
 
-			if (0 == std::string_view(name).find_first_of(":@$")) {
+			if (0 == name.find_first_of(":@$")) {
 				i = bind_parameter_index(name) - 1;
 			}
 			else {
@@ -879,21 +1086,253 @@ namespace sqlite {
 
 			return proxy(*this, i);
 		}
-		proxy operator[](const std::string_view name)
+		proxy operator[](const char* name)
+		{
+			return operator[](std::string_view(name));
+		}
+
+		// Columns of the current row. Valid until the next step.
+		class row_view : public std::ranges::view_interface<row_view> {
+			stmt* s = nullptr;
+		public:
+			// Random access over 0-based column proxies.
+			class iterator {
+				stmt* s = nullptr;
+				int j = 0;
+			public:
+				using iterator_concept = std::random_access_iterator_tag;
+				using value_type = proxy;
+				using difference_type = std::ptrdiff_t;
+
+				iterator() = default;
+				iterator(stmt* s, int j) noexcept
+					: s{ s }, j{ j }
+				{ }
+
+				bool operator==(const iterator&) const = default;
+				auto operator<=>(const iterator&) const = default;
+
+				proxy operator*() const
+				{
+					return proxy(*s, j);
+				}
+				proxy operator[](difference_type n) const
+				{
+					return proxy(*s, j + static_cast<int>(n));
+				}
+				iterator& operator++()
+				{
+					++j;
+
+					return *this;
+				}
+				iterator operator++(int)
+				{
+					return iterator(s, j++);
+				}
+				iterator& operator--()
+				{
+					--j;
+
+					return *this;
+				}
+				iterator operator--(int)
+				{
+					return iterator(s, j--);
+				}
+				iterator& operator+=(difference_type n)
+				{
+					j += static_cast<int>(n);
+
+					return *this;
+				}
+				iterator& operator-=(difference_type n)
+				{
+					j -= static_cast<int>(n);
+
+					return *this;
+				}
+				friend iterator operator+(iterator i, difference_type n)
+				{
+					return i += n;
+				}
+				friend iterator operator+(difference_type n, iterator i)
+				{
+					return i += n;
+				}
+				friend iterator operator-(iterator i, difference_type n)
+				{
+					return i -= n;
+				}
+				friend difference_type operator-(const iterator& i, const iterator& k)
+				{
+					return i.j - k.j;
+				}
+			};
+
+			row_view() = default;
+			explicit row_view(stmt& s) noexcept
+				: s{ &s }
+			{ }
+
+			iterator begin() const
+			{
+				return iterator(s, 0);
+			}
+			iterator end() const
+			{
+				return iterator(s, s->column_count());
+			}
+
+			proxy operator[](int j) const
+			{
+				return proxy(*s, j);
+			}
+			proxy operator[](const std::string_view& name) const
+			{
+				return proxy(*s, s->column_index(name));
+			}
+			// Typed 0-based column value.
+			template<class T>
+			T get(int j) const
+			{
+				return s->column<T>(j);
+			}
+			// Typed values of the leading columns.
+			template<class... T>
+			std::tuple<T...> as() const
+			{
+				return s->row<T...>();
+			}
+		};
+
+		// Single pass over the rows of a statement.
+		// Steps lazily, once per row, so views such as take do not step past the last row used.
+		// Rows are never materialized.
+		// for (auto row : stmt.rows()) { row[0], row.get<int>(1), ... }
+		class rows_view : public std::ranges::view_interface<rows_view> {
+			stmt* s = nullptr;
+		public:
+			class iterator {
+				stmt* s = nullptr;
+				mutable bool pending = false; // step before the next access
+
+				void sync() const
+				{
+					if (pending) {
+						pending = false;
+						s->step();
+					}
+				}
+			public:
+				using iterator_concept = std::input_iterator_tag;
+				using value_type = row_view;
+				using difference_type = std::ptrdiff_t;
+
+				iterator() = default;
+				explicit iterator(stmt* s) noexcept
+					: s{ s }, pending{ s != nullptr }
+				{ }
+
+				row_view operator*() const
+				{
+					sync();
+
+					return row_view(*s);
+				}
+				iterator& operator++()
+				{
+					sync(); // row was not accessed
+					pending = true;
+
+					return *this;
+				}
+				void operator++(int)
+				{
+					operator++();
+				}
+				bool operator==(std::default_sentinel_t) const
+				{
+					if (!s) {
+						return true;
+					}
+					sync();
+
+					return s->ret != SQLITE_ROW;
+				}
+			};
+
+			rows_view() = default;
+			explicit rows_view(stmt& s) noexcept
+				: s{ &s }
+			{ }
+
+			// Call only once.
+			iterator begin() const
+			{
+				return iterator(s);
+			}
+			std::default_sentinel_t end() const noexcept
+			{
+				return std::default_sentinel;
+			}
+		};
+
+		// Rows remaining in the statement. Call reset() to iterate again.
+		rows_view rows() noexcept
 		{
-			std::string s(name);
-			return operator[](s.c_str());
+			return rows_view(*this);
 		}
 
+		// Bind text and blobs with SQLITE_STATIC. The statement is reset and its
+		// bindings cleared when this goes out of scope so SQLite never sees a
+		// borrowed buffer after the guard is gone.
+		// { stmt::borrowed_bindings b(stmt); b.bind(1, view); stmt.step(); }
+		class borrowed_bindings {
+			stmt& s;
+		public:
+			borrowed_bindings(stmt& s) noexcept
+				: s{ s }
+			{ }
+			borrowed_bindings(const borrowed_bindings&) = delete;
+			borrowed_bindings& operator=(const borrowed_bindings&) = delete;
+			~borrowed_bindings()
+			{
+				sqlite3_reset(s);
+				sqlite3_clear_bindings(s);
+			}
+
+			borrowed_bindings& bind(int i, const std::string_view& str)
+			{
+				s.bind(i, str, SQLITE_STATIC);
+
+				return *this;
+			}
+			borrowed_bindings& bind(int i, const std::wstring_view& str)
+			{
+				s.bind(i, str, SQLITE_STATIC);
+
+				return *this;
+			}
+			borrowed_bindings& bind(int i, const void* data, size_t len)
+			{
+				s.bind(i, data, len, SQLITE_STATIC);
+
+				return *this;
+			}
+		};
+
 		// https://www.sqlite.org/c3ref/bind_parameter_index.html
 		int bind_parameter_index(const char* name) const
 		{
 			return sqlite3_bind_parameter_index(pstmt, name);
 		}
+		// Hashed lookup, 0 if not found.
 		int bind_parameter_index(const std::string_view& name) const
 		{
-			std::string s(name);
-			return bind_parameter_index(s.data());
+			const name_index* i = find_name(name);
+
+			return i ? i->parameter : 0;
 		}
 
 		//
@@ -909,7 +1348,7 @@ namespace sqlite {
 		// null
 		stmt& bind(int i)
 		{
-			FMS_SQLITE_ERRSTR(ret = sqlite3_bind_null(pstmt, i));
+			FMS_SQLITE_ERRMSG(db_handle(), ret = sqlite3_bind_null(pstmt, i));
 
 			return *this;
 		}
@@ -947,10 +1386,14 @@ namespace sqlite {
 
 			return *this;
 		}
+		// Pointer and length are passed through, no copy is made before calling SQLite.
 		stmt& bind(int i, const std::string_view& str, void(*cb)(void*) = SQLITE_TRANSIENT)
 		{
-			std::string s(str);
-			return bind(i, s.c_str(), static_cast<int>(s.size()), cb);
+			// empty, not NULL
+			const char* data = str.data() ? str.data() : "";
+			FMS_SQLITE_ERRMSG(db_handle(), sqlite3_bind_text(pstmt, i, data, static_cast<int>(str.size()), cb));
+
+			return *this;
 		}
 
 		// text16 with length in characters
@@ -964,10 +1407,13 @@ namespace sqlite {
 
 			return *this;
 		}
-		stmt& bind(int i, std::wstring_view&  str, void(*cb)(void*) = SQLITE_TRANSIENT)
+		stmt& bind(int i, const std::wstring_view& str, void(*cb)(void*) = SQLITE_TRANSIENT)
 		{
-			std::wstring s(str);
-			return bind(i, s.data(), (int)s.length(), cb);
+			const wchar_t* data = str.data() ? str.data() : L"";
+			FMS_SQLITE_ERRMSG(db_handle(), sqlite3_bind_text16(pstmt, i,
+				(const void*)data, 2 * static_cast<int>(str.size()), cb));
+
+			return *this;
 		}
 
 		// Default to static.
@@ -1016,6 +1462,106 @@ namespace sqlite {
 			return sqlite3_bind_parameter_index(pstmt, name);
 		}
 
+		// Call the sqlite3_bind_* function for the C++ type of t and return its result code.
+		template<class T>
+		int bind_typed(int i, const T& t, void(*cb)(void*) = SQLITE_TRANSIENT) noexcept
+		{
+			if constexpr (std::is_same_v<T, bool> or (std::is_integral_v<T> and (sizeof(T) < sizeof(int)
+				or (std::is_signed_v<T> and sizeof(T) == sizeof(int))))) {
+				return sqlite3_bind_int(pstmt, i, static_cast<int>(t));
+			}
+			else if constexpr (std::is_integral_v<T>) {
+				// unsigned 64-bit values above INT64_MAX do not fit
+				if constexpr (std::is_unsigned_v<T> and sizeof(T) >= sizeof(sqlite3_int64)) {
+					if (t > static_cast<T>(std::numeric_limits<sqlite3_int64>::max())) {
+						return SQLITE_MISMATCH;
+					}
+				}
+				return sqlite3_bind_int64(pstmt, i, static_cast<sqlite3_int64>(t));
+			}
+			else if constexpr (std::is_floating_point_v<T>) {
+				return sqlite3_bind_double(pstmt, i, static_cast<double>(t));
+			}
+			else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+				const std::string_view s(t);
+				return sqlite3_bind_text(pstmt, i, s.data() ? s.data() : "", static_cast<int>(s.size()), cb);
+			}
+			else if constexpr (std::is_same_v<T, datetime>) {
+				switch (t.type) {
+				case SQLITE_FLOAT:
+					return sqlite3_bind_double(pstmt, i, t.value.f);
+				case SQLITE_INTEGER:
+					return sqlite3_bind_int64(pstmt, i, t.value.i);
+				case SQLITE_TEXT:
+					return sqlite3_bind_text(pstmt, i, (const char*)t.value.t, -1, cb);
+				}
+				return sqlite3_bind_null(pstmt, i);
+			}
+			else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+				return sqlite3_bind_null(pstmt, i);
+			}
+			else {
+				static_assert(sizeof(T) == 0, "sqlite::stmt::bind_typed: unsupported type");
+			}
+		}
+
+		// Bind parameters 1, 2, ... and check for errors once.
+		// stmt.bind_all(123, 1.23, "str");
+		template<class... Ts>
+		stmt& bind_all(const Ts&... ts)
+		{
+			int i = 0;
+			int rc = SQLITE_OK;
+			// stop at first error
+			((rc = (rc == SQLITE_OK ? bind_typed(++i, ts) : rc)), ...);
+			if (rc != SQLITE_OK) {
+				const std::string mesg = "parameter " + std::to_string(i) + ": " + sqlite3_errstr(rc);
+				throw_error(rc, db_handle(), pstmt ? sql() : "", mesg.c_str());
+			}
+
+			return *this;
+		}
+		template<class... Ts>
+		stmt& bind_all(const std::tuple<Ts...>& t)
+		{
+			return std::apply([this](const Ts&... ts) -> stmt& { return bind_all(ts...); }, t);
+		}
+
+		// Bind each tuple in r, step, and reset. Runs in one transaction
+		// unless a transaction is already open. Returns the number of rows.
+		template<std::ranges::input_range R>
+		size_t execute_many(R&& r)
+		{
+			sqlite3* pdb = db_handle();
+			const bool begin = sqlite3_get_autocommit(pdb) != 0;
+			if (begin) {
+				FMS_SQLITE_ERRMSG(pdb, sqlite3_exec(pdb, "BEGIN TRANSACTION;", 0, 0, 0));
+			}
+
+			size_t n = 0;
+			try {
+				for (const auto& t : r) {
+					bind_all(t);
+					while (SQLITE_ROW == step())
+						;
+					sqlite3_reset(pstmt);
+					++n;
+				}
+			}
+			catch (...) {
+				sqlite3_reset(pstmt);
+				if (begin) {
+					sqlite3_exec(pdb, "ROLLBACK TRANSACTION;", 0, 0, 0);
+				}
+				throw;
+			}
+			if (begin) {
+				FMS_SQLITE_ERRMSG(pdb, sqlite3_exec(pdb, "COMMIT TRANSACTION;", 0, 0, 0));
+			}
+
+			return n;
+		}
+
 		//
 		// 0-based names
 		//
@@ -1029,15 +1575,12 @@ namespace sqlite {
 		{
 			return sqlite3_column_name(pstmt, j);
 		}
+		// Hashed lookup.
 		int column_index(const std::string_view& name) const
 		{
-			for (int i = 0; i < column_count(); ++i) {
-				if (name == column_name(i)) {
-					return i;
-				}
-			}
+			const name_index* i = find_name(name);
 
-			return -1; // out-of-range lookup returns NULL
+			return i ? i->column : -1; // out-of-range lookup returns NULL
 		}
 		const void* column_name16(int j) const
 		{
@@ -1061,19 +1604,56 @@ namespace sqlite {
 		{
 			return sqlite3_column_decltype(pstmt, j);
 		}
+
+		// Metadata for all columns, computed once after prepare.
+		const std::vector<column_info>& metadata() const
+		{
+			if (!described) {
+				const int n = column_count();
+				info.clear();
+				info.reserve(n);
+				for (int j = 0; j < n; ++j) {
+					const char* decl = column_decltype(j);
+					const std::string_view d = decl ? decl : "";
+					info.push_back(column_info{
+						.name = column_name(j),
+						.decl = std::string(d),
+						.affinity = sqlite::affinity(d),
+						.type = decl ? sqlite::sql_type(d) : SQLITE_UNKNOWN,
+						.extended_type = decl ? sqlite::sql_extended_type(d) : SQLITE_UNKNOWN,
+					});
+#ifdef SQLITE_ENABLE_COLUMN_METADATA
+					if (const char* table = sqlite3_column_table_name(pstmt, j)) {
+						info.back().table = table;
+					}
+					if (const char* origin = sqlite3_column_origin_name(pstmt, j)) {
+						info.back().origin = origin;
+					}
+#endif
+				}
+				described = true;
+			}
+
+			return info;
+		}
+		const column_info& metadata(int j) const
+		{
+			return metadata()[j];
+		}
+
 		// SQLITE_* type or fallback to fundamental type.
 		int sql_type(int j) const
 		{
-			const char* type = column_decltype(j);
+			const int type = metadata()[j].type;
 
-			return type ? sqlite::sql_type(column_decltype(j)) : column_type(j);
+			return type != SQLITE_UNKNOWN ? type : column_type(j);
 		}
 		// Extended SQLITE_* type or fallback to fundamental type.
 		int sql_extended_type(int j) const
 		{
-			const char* type = column_decltype(j);
+			const int type = metadata()[j].extended_type;
 
-			return type ? sqlite::sql_extended_type(column_decltype(j)) : column_type(j);
+			return type != SQLITE_UNKNOWN ? type : column_type(j);
 		}
 
 		//
@@ -1153,49 +1733,1101 @@ namespace sqlite {
 			return datetime(time_t(-1));
 		}
 
-	};
+		// Typed 0-based column value.
+		template<class T>
+		T column(int j) const
+		{
+			if constexpr (std::is_same_v<T, bool>) {
+				return column_boolean(j);
+			}
+			else if constexpr (std::is_integral_v<T> and (sizeof(T) < sizeof(int)
+				or (std::is_signed_v<T> and sizeof(T) == sizeof(int)))) {
+				return static_cast<T>(column_int(j));
+			}
+			else if constexpr (std::is_integral_v<T>) {
+				const sqlite3_int64 i = column_int64(j);
+				if constexpr (std::is_unsigned_v<T> and sizeof(T) >= sizeof(sqlite3_int64)) {
+					if (i < 0) {
+						const char* name = column_name(j);
+						const std::string mesg = "column " + (name ? std::string(name) : std::to_string(j))
+							+ ": negative value for an unsigned type";
+						throw_error(SQLITE_MISMATCH, nullptr, sql(), mesg.c_str());
+					}
+				}
 
-	enum class transaction_mode {
-		deferred,
-		immediate,
-		exclusive,
-	};
+				return static_cast<T>(i);
+			}
+			else if constexpr (std::is_floating_point_v<T>) {
+				return static_cast<T>(column_double(j));
+			}
+			else if constexpr (std::is_same_v<T, std::string_view>) {
+				return column_text_view(j);
+			}
+			else if constexpr (std::is_same_v<T, std::string>) {
+				return std::string(column_text_view(j));
+			}
+			else if constexpr (std::is_same_v<T, const char*>) {
+				return (const char*)column_text(j);
+			}
+			else if constexpr (std::is_same_v<T, std::wstring_view>) {
+				return column_text16_view(j);
+			}
+			else if constexpr (std::is_same_v<T, datetime>) {
+				return column_datetime(j);
+			}
+			else {
+				static_assert(sizeof(T) == 0, "sqlite::stmt::column: unsupported type");
+			}
+		}
 
-	// Execute prepared statement as a transaction.
-	// Consumes stmt, commit if succesfull, rollback otherwise.
-	// https://sqlite.org/lang_transaction.html
-	int transact(stmt& s, transaction_mode mode = transaction_mode::deferred)
-	{
-		stmt t;
+		// Current row as a tuple.
+		// auto [a, b] = stmt.row<int64_t, std::string_view>();
+		template<class... T>
+		std::tuple<T...> row() const
+		{
+			return [this]<size_t... J>(std::index_sequence<J...>) {
+				return std::tuple<T...>(column<T>(static_cast<int>(J))...);
+			}(std::index_sequence_for<T...>{});
+		}
+		// Step up to n rows into b. Returns number of rows fetched, 0 when done.
+		// Call reset() to run the statement again.
+		// Column storage type is the declared type, or the type of the first value fetched
+		// if the declared type is NUMERIC or missing. Values are converted to the storage type.
+		// BOOLEAN columns are stored as INTEGER and DATETIME columns as INTEGER Unix time.
+		// Storage types are kept for later fetches into b, call b.clear() to decide them again.
+		size_t fetch_batch(batch& b, size_t n)
+		{
+			const int m = column_count();
+			b.rows = 0;
+			if (b.cols.size() != static_cast<size_t>(m)) {
+				b.clear();
+				b.cols.resize(m);
+			}
+			if (ret == SQLITE_DONE) {
+				return 0; // do not let sqlite3_step restart the statement
+			}
 
-		const char* trans;
-		switch (mode) {
-		case transaction_mode::immediate:
-			trans = "BEGIN TRANSACTION IMMEDIATE;";
-			break;
-		case transaction_mode::exclusive:
-			trans = "BEGIN TRANSACTION EXCLUSIVE;";
-			break;
-		case transaction_mode::deferred:
-		default:
-			trans = "BEGIN TRANSACTION DEFERRED;";
-			break;
-		}
-		FMS_SQLITE_ERRSTR(sqlite3_exec(s.db_handle(), trans, 0, 0, 0));
+			while (b.rows < n and SQLITE_ROW == step()) {
+				if (b.rows == 0) {
+					for (int j = 0; j < m; ++j) {
+						auto& c = b.cols[j];
+						if (c.type == SQLITE_NULL) {
+							const auto& info = metadata(j);
+							c.type = info.extended_type == SQLITE_BOOLEAN or info.extended_type == SQLITE_DATETIME
+								? SQLITE_INTEGER : info.type;
+							if (c.type != SQLITE_INTEGER and c.type != SQLITE_FLOAT and c.type != SQLITE_TEXT and c.type != SQLITE_BLOB) {
+								c.type = column_type(j);
+								if (c.type == SQLITE_NULL) {
+									c.type = SQLITE_TEXT;
+								}
+							}
+						}
+						c.integer.clear();
+						c.real.clear();
+						c.offset.assign(1, 0);
+						c.arena.clear();
+						c.valid.assign((n + 7) / 8, 0);
+						c.nulls = 0;
+						if (c.type == SQLITE_INTEGER) {
+							c.integer.reserve(n);
+						}
+						else if (c.type == SQLITE_FLOAT) {
+							c.real.reserve(n);
+						}
+						else {
+							c.offset.reserve(n + 1);
+						}
+					}
+				}
+
+				const size_t i = b.rows;
+				for (int j = 0; j < m; ++j) {
+					auto& c = b.cols[j];
+					if (column_type(j) == SQLITE_NULL) {
+						++c.nulls;
+					}
+					else {
+						c.valid[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+					}
+					switch (c.type) {
+					case SQLITE_INTEGER:
+						if (metadata(j).extended_type == SQLITE_DATETIME) {
+							c.integer.push_back(column_datetime(j).to_time_t());
+						}
+						else {
+							c.integer.push_back(column_int64(j));
+						}
+						break;
+					case SQLITE_FLOAT:
+						c.real.push_back(column_double(j));
+						break;
+					case SQLITE_TEXT:
+						c.arena.append(column_text_view(j));
+						c.offset.push_back(c.arena.size());
+						break;
+					case SQLITE_BLOB: {
+						const char* p = (const char*)column_blob(j);
+						c.arena.append(p, p ? column_bytes(j) : 0);
+						c.offset.push_back(c.arena.size());
+						break;
+					}
+					}
+				}
+				++b.rows;
+			}
+
+			return b.rows;
+		}
+		batch fetch_batch(size_t n)
+		{
+			batch b;
+			fetch_batch(b, n);
+
+			return b;
+		}
+
+		// Decode the current row into the members of an aggregate in column order.
+		template<class S>
+		S& row_into(S& s) const
+		{
+			auto m = tie_members(s);
+			constexpr int n = static_cast<int>(std::tuple_size_v<decltype(m)>);
+			if (column_count() != n) {
+				throw std::runtime_error(fms::error("sqlite::stmt::row_into: column count does not match number of members").what());
+			}
+			[this, &m]<size_t... J>(std::index_sequence<J...>) {
+				((std::get<J>(m) = column<std::remove_reference_t<std::tuple_element_t<J, decltype(m)>>>(static_cast<int>(J))), ...);
+			}(std::make_index_sequence<n>{});
+
+			return s;
+		}
+
+	};
+	static_assert(std::ranges::view<stmt::rows_view> and std::ranges::input_range<stmt::rows_view>);
+	static_assert(std::ranges::view<stmt::row_view> and std::ranges::random_access_range<stmt::row_view>);
+
+	template<class... T>
+	struct params {};
+	template<class... T>
+	struct columns {};
+
+	// Statement with compile-time SQL, parameter types, and column types.
+	// stmt_t<"INSERT INTO t VALUES (?, ?)", params<int, double>> insert(db);
+	// stmt_t<"SELECT a, b FROM t", params<>, columns<int, double>> select(db);
+	template<fixed_string SQL, class P = params<>, class C = columns<>>
+	class stmt_t;
+
+	template<fixed_string SQL, class... P, class... C>
+	class stmt_t<SQL, params<P...>, columns<C...>> : public stmt {
+		static_assert(parameter_count(SQL.view()) == sizeof...(P), "sqlite::stmt_t: parameter count mismatch");
+
+		static sqlite3_stmt* compile(sqlite3* pdb, unsigned int flags)
+		{
+			sqlite3_stmt* pstmt = nullptr;
+			// include null terminator
+			if (int rc = sqlite3_prepare_v3(pdb, SQL.str, sizeof(SQL.str), flags, &pstmt, nullptr); rc != SQLITE_OK) {
+				throw_error(rc, pdb, SQL.view());
+			}
+
+			return pstmt;
+		}
+	public:
+		template<int J>
+		using param_type = std::tuple_element_t<J - 1, std::tuple<P...>>;
+		template<int I>
+		using column_type = std::tuple_element_t<I, std::tuple<C...>>;
+
+		using stmt::bind;
+		using stmt::column;
+
+		// Typed statements are long-lived so default to persistent.
+		explicit stmt_t(sqlite3* pdb, unsigned int flags = SQLITE_PREPARE_PERSISTENT)
+			: stmt(compile(pdb, flags))
+		{
+			if (column_count() != sizeof...(C)) {
+				throw std::runtime_error(fms::error("sqlite::stmt_t: column count mismatch").at(SQL.view()).what());
+			}
+		}
+		stmt_t(const stmt_t&) = delete;
+		stmt_t& operator=(const stmt_t&) = delete;
+
+		// 1-based parameter
+		template<int J>
+		stmt_t& bind(const param_type<J>& p)
+		{
+			FMS_SQLITE_ERRMSG(db_handle(), bind_typed(J, p));
+
+			return *this;
+		}
+		// Bind all parameters. Not an overload of bind, which would be ambiguous with stmt::bind.
+		stmt_t& bind_params(const P&... p)
+		{
+			bind_all(p...);
+
+			return *this;
+		}
+
+		// 0-based column
+		template<int I>
+		column_type<I> column() const
+		{
+			return stmt::column<column_type<I>>(I);
+		}
+	};
+
+	// Bounded LRU cache of prepared statements keyed by SQL text.
+	// Statements are leased out and returned reset and cleared when the lease goes out of scope.
+	class stmt_cache {
+		struct entry {
+			std::string sql;
+			sqlite3_stmt* pstmt;
+		};
+		using iterator = std::list<entry>::iterator;
+
+		std::list<entry> idle;   // most recently used at front
+		std::list<entry> leased; // checked out
+		std::unordered_map<std::string_view, iterator> index; // sql -> idle entry
+		size_t capacity_;
+		unsigned int flags_; // sqlite3_prepare_v3 flags
+		size_t hits_, misses_, evictions_;
+
+		void evict()
+		{
+			while (idle.size() > capacity_) {
+				auto it = std::prev(idle.end());
+				index.erase(it->sql);
+				sqlite3_finalize(it->pstmt);
+				idle.erase(it);
+				++evictions_;
+			}
+		}
+	public:
+		class lease;
+
+		// Cached statements are long-lived so default to persistent.
+		stmt_cache(size_t capacity = 32, unsigned int flags = SQLITE_PREPARE_PERSISTENT)
+			: capacity_{ capacity }, flags_{ flags }, hits_{ 0 }, misses_{ 0 }, evictions_{ 0 }
+		{ }
+		stmt_cache(const stmt_cache&) = delete;
+		stmt_cache& operator=(const stmt_cache&) = delete;
+		// Leases must not outlive the cache.
+		~stmt_cache()
+		{
+			clear();
+		}
+
+		size_t capacity() const
+		{
+			return capacity_;
+		}
+		// Zero capacity disables caching.
+		stmt_cache& capacity(size_t n)
+		{
+			capacity_ = n;
+			evict();
+
+			return *this;
+		}
+		unsigned int flags() const
+		{
+			return flags_;
+		}
+		// Flags used for statements prepared after this call.
+		stmt_cache& flags(unsigned int f)
+		{
+			flags_ = f;
+
+			return *this;
+		}
+		// Number of idle statements.
+		size_t size() const
+		{
+			return idle.size();
+		}
+		size_t hits() const
+		{
+			return hits_;
+		}
+		size_t misses() const
+		{
+			return misses_;
+		}
+		size_t evictions() const
+		{
+			return evictions_;
+		}
+
+		// Finalize all idle statements.
+		void clear()
+		{
+			for (auto& e : idle) {
+				sqlite3_finalize(e.pstmt);
+			}
+			idle.clear();
+			index.clear();
+		}
+
+		// Check out a statement for sql, preparing it on a miss.
+		iterator acquire(sqlite3* pdb, const std::string_view& sql)
+		{
+			if (auto i = index.find(sql); i != index.end()) {
+				iterator it = i->second;
+				index.erase(i);
+				leased.splice(leased.begin(), idle, it);
+				++hits_;
+
+				return it;
+			}
+
+			sqlite3_stmt* pstmt = nullptr;
+			if (int rc = sqlite3_prepare_v3(pdb, sql.data(), static_cast<int>(sql.size()), flags_, &pstmt, nullptr); rc != SQLITE_OK) {
+				throw_error(rc, pdb, sql);
+			}
+			++misses_;
+
+			return leased.emplace(leased.begin(), entry{ std::string(sql), pstmt });
+		}
+		// Return a statement to the cache. The lease passes the statement it currently owns.
+		void release(iterator it, sqlite3_stmt* pstmt) noexcept
+		{
+			if (pstmt != it->pstmt or index.contains(it->sql) or capacity_ == 0) {
+				// re-prepared by the lease, duplicate, or not caching
+				sqlite3_finalize(pstmt);
+				leased.erase(it);
+
+				return;
+			}
+
+			sqlite3_reset(pstmt);
+			sqlite3_clear_bindings(pstmt);
+			idle.splice(idle.begin(), leased, it);
+			index.emplace(it->sql, it);
+			evict();
+		}
+	};
+
+	// Statement checked out of a stmt_cache.
+	class stmt_cache::lease : public stmt {
+		stmt_cache& cache;
+		iterator it;
+	public:
+		lease(stmt_cache& cache, iterator it) noexcept
+			: stmt(it->pstmt), cache{ cache }, it{ it }
+		{ }
+		lease(const lease&) = delete;
+		lease& operator=(const lease&) = delete;
+		~lease()
+		{
+			cache.release(it, stmt::release());
+		}
+	};
+
+	// Values of SQLITE_PRAGMA_SETTINGS, unset values are left unchanged.
+	struct pragma_settings {
+#define SQLITE_PRAGMA_SETTING(a, T) std::optional<T> a;
+		SQLITE_PRAGMA_SETTINGS(SQLITE_PRAGMA_SETTING)
+#undef SQLITE_PRAGMA_SETTING
+
+		// Set key from its PRAGMA text, e.g. set("synchronous", "NORMAL").
+		// Returns false if key is not a runtime setting.
+		bool set(const std::string_view& key, const std::string_view& value)
+		{
+#define SQLITE_PRAGMA_SETTING(a, T) if (key == #a) { a = as<T>(value); return true; }
+			SQLITE_PRAGMA_SETTINGS(SQLITE_PRAGMA_SETTING)
+#undef SQLITE_PRAGMA_SETTING
+			return false;
+		}
+	private:
+		template<class T>
+		static T as(const std::string_view& value)
+		{
+			if constexpr (std::is_same_v<T, std::string>) {
+				return std::string(value);
+			}
+			else {
+				// keywords of synchronous, temp_store, foreign_keys, and query_only
+				static constexpr std::pair<std::string_view, int> keyword[] = {
+					{ "OFF", 0 }, { "ON", 1 }, { "NORMAL", 1 }, { "FULL", 2 }, { "EXTRA", 3 },
+					{ "DEFAULT", 0 }, { "FILE", 1 }, { "MEMORY", 2 },
+				};
+				for (const auto& [k, i] : keyword) {
+					if (value == k) {
+						return i;
+					}
+				}
+				T t{};
+				const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), t);
+				if (ec != std::errc{} or ptr != value.data() + value.size()) {
+					throw std::runtime_error(fms::error("sqlite::pragma_settings: invalid value").at(value).what());
+				}
+
+				return t;
+			}
+		}
+	};
+
+	// Named workloads.
+	enum class pragma_profile {
+		bulk_load, // no journal, no sync, exclusive lock, large cache
+		oltp,      // SQLITE_DEFAULTS
+		analytics, // large cache and mmap
+		read_only, // query_only
+	};
+
+	inline pragma_settings profile_settings(pragma_profile p)
+	{
+		switch (p) {
+		case pragma_profile::bulk_load:
+			return pragma_settings{ .locking_mode = "EXCLUSIVE", .journal_mode = "OFF", .synchronous = 0,
+				.cache_size = -1'000'000, .temp_store = 2, .query_only = 0 };
+		case pragma_profile::oltp: {
+			pragma_settings ps{ .locking_mode = "NORMAL", .query_only = 0 };
+#define SQLITE_DEFAULT_PRAGMA(a, b) ps.set(#a, #b);
+			SQLITE_DEFAULTS(SQLITE_DEFAULT_PRAGMA)
+#undef SQLITE_DEFAULT_PRAGMA
+			return ps;
+		}
+		case pragma_profile::analytics:
+			return pragma_settings{ .locking_mode = "NORMAL", .journal_mode = "WAL", .synchronous = 1,
+				.busy_timeout = 5000, .cache_size = -1'000'000, .mmap_size = 2147483648, .temp_store = 2,
+				.query_only = 0 };
+		case pragma_profile::read_only:
+			return pragma_settings{ .locking_mode = "NORMAL", .busy_timeout = 5000, .cache_size = -200'000,
+				.mmap_size = 2147483648, .query_only = 1 };
+		}
+
+		return pragma_settings{};
+	}
+
+	class scoped_bulk_load;
+
+	// RAII class for sqlite3* database handle.
+	class db {
+		sqlite3* pdb;
+
+		// True if sql is one statement with optional trailing semicolons.
+		static bool single_statement(const std::string_view& sql)
+		{
+			constexpr const char* space = " \t\r\n";
+
+			if (sql.find_first_not_of(space) == std::string_view::npos) {
+				return false;
+			}
+			const auto semi = sql.find(';');
+
+			return semi == std::string_view::npos
+				or sql.find_first_not_of("; \t\r\n", semi) == std::string_view::npos;
+		}
+		// Throw the open error and free the handle SQLite allocated anyway.
+		[[noreturn]] void fail_open(int rc)
+		{
+			try {
+				throw_error(rc, pdb);
+			}
+			catch (...) {
+				sqlite3_close(pdb);
+				pdb = nullptr;
+				throw;
+			}
+		}
+	public:
+		char* perrmsg; // might not be the same as sqlite3_errmsg()
+		stmt_cache cache; // used by exec and cached
+
+		db()
+			: pdb(nullptr), perrmsg(nullptr)
+		{
+		}
+		// db("") for in-memory database
+		db(const char* filename = "", int flags = 0, const char* zVfs = nullptr)
+			: pdb(nullptr), perrmsg(nullptr)
+		{
+			open(filename, flags, zVfs);
+		}
+		// so ~db is called only once
+		db(const db&) = delete;
+		db& operator=(const db&) = delete;
+		// https://sqlite.org/c3ref/close.html
+		~db()
+		{
+			close();
+		}
+
+		// For use in the sqlite C API.
+		operator sqlite3* ()
+		{
+			return pdb;
+		}
+
+		bool operator==(const db& db) const
+		{
+			return pdb == db.pdb;
+		}
+
+		// https://sqlite.org/c3ref/open.html
+		db& open(const char* filename, int flags = 0, const char* zVfs = nullptr)
+		{
+			if (!flags) {
+				flags = (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+			}
+			if (!filename || !*filename) {
+				flags |= SQLITE_OPEN_MEMORY;
+			}
+
+			if (int rc = sqlite3_open_v2(filename, &pdb, flags, zVfs); rc != SQLITE_OK) {
+				fail_open(rc);
+			}
+
+			return *this;
+		}
+		// Default encoding will be UTF-16 in the native byte order.
+		db& open(const wchar_t* filename)
+		{
+			if (int rc = sqlite3_open16(filename, &pdb); rc != SQLITE_OK) {
+				fail_open(rc);
+			}
+
+			return *this;
+		}
+		db& close()
+		{
+			if (perrmsg) {
+				sqlite3_free(perrmsg);
+				perrmsg = nullptr;
+			}
+			cache.clear();
+			sqlite3_close(pdb);
+			pdb = nullptr;
+
+			return *this;
+		}
+		// PRAGMA key = value;
+		template<class T>
+		int pragma(const std::string_view& key, const T& value)
+		{
+			std::string sql("PRAGMA ");
+			sql.append(key).append(" = ");
+			if constexpr (std::is_arithmetic_v<T>) {
+				sql.append(std::to_string(value));
+			}
+			else {
+				sql.append(value);
+			}
+
+			return exec(sql.c_str());
+		}
+		// Current value of PRAGMA key.
+		template<class T>
+		T pragma(const std::string_view& key)
+		{
+			auto s = cached(std::string("PRAGMA ").append(key));
+			if (s.step() != SQLITE_ROW) {
+				throw std::runtime_error(fms::error("sqlite::db::pragma: no value").at(key).what());
+			}
+
+			return s.column<T>(0);
+		}
+		// Current values of the pragmas set in which.
+		pragma_settings pragmas(const pragma_settings& which)
+		{
+			pragma_settings ps;
+#define SQLITE_PRAGMA_SETTING(a, T) if (which.a) ps.a = pragma<T>(#a);
+			SQLITE_PRAGMA_SETTINGS(SQLITE_PRAGMA_SETTING)
+#undef SQLITE_PRAGMA_SETTING
+			return ps;
+		}
+		// Set all values in ps, or none of them if one fails.
+		// Returns the previous values for restoring with apply.
+		pragma_settings apply(const pragma_settings& ps)
+		{
+			const pragma_settings prev = pragmas(ps);
+			try {
+#define SQLITE_PRAGMA_SETTING(a, T) if (ps.a) pragma(#a, *ps.a);
+				SQLITE_PRAGMA_SETTINGS(SQLITE_PRAGMA_SETTING)
+#undef SQLITE_PRAGMA_SETTING
+			}
+			catch (...) {
+#define SQLITE_PRAGMA_SETTING(a, T) if (prev.a) try { pragma(#a, *prev.a); } catch (...) { }
+				SQLITE_PRAGMA_SETTINGS(SQLITE_PRAGMA_SETTING)
+#undef SQLITE_PRAGMA_SETTING
+				throw;
+			}
+
+			return prev;
+		}
+		pragma_settings apply(pragma_profile p)
+		{
+			return apply(profile_settings(p));
+		}
+		// Bulk-load mode for tables until the result goes out of scope.
+		// auto load = db.bulk_load("t", "u"); ... load.finish();
+		template<class... T>
+		scoped_bulk_load bulk_load(const T&... tables);
+		int default_pragmas()
+		{
+			int ret = SQLITE_OK;
+#define SQLITE_DEFAULT_PRAGMA(a, b) ret = pragma(#a, #b); if (ret != SQLITE_OK) return ret;
+			SQLITE_DEFAULTS(SQLITE_DEFAULT_PRAGMA)
+#undef SQLITE_DEFAULT_PRAGMA
+			return ret;
+		}
+		// Statement for sql from the cache, prepared on a miss.
+		// Only the first statement of sql is prepared.
+		stmt_cache::lease cached(const std::string_view& sql)
+		{
+			return stmt_cache::lease(cache, cache.acquire(pdb, sql));
+		}
+
+		// Run zero or more UTF-8 encoded, semicolon-separate SQL statements.
+		// A single statement is run using the statement cache.
+		// https://sqlite.org/c3ref/exec.html
+		using callback = int (*)(void* data, int col, char** text, char** name);
+		int exec(const char* sql, callback cb = nullptr, void* data = nullptr)
+		{
+			if (perrmsg) {
+				sqlite3_free(perrmsg);
+				perrmsg = nullptr;
+			}
+			if (cache.capacity() and single_statement(sql)) {
+				return exec_cached(sql, cb, data);
+			}
+			int ret = sqlite3_exec(pdb, sql, cb, data, &perrmsg);
+			if (ret != SQLITE_OK) {
+				throw_error(ret, pdb, sql, perrmsg);
+			}
+
+			return ret;
+		}
+		// Same semantics as sqlite3_exec for a single statement, including perrmsg on error.
+		int exec_cached(const char* sql, callback cb, void* data)
+		{
+			try {
+				auto s = cached(sql);
+				if (!s) {
+					return SQLITE_OK; // comment or whitespace
+				}
+				std::vector<char*> cols; // text then names
+				int ret;
+
+				while (SQLITE_ROW == (ret = sqlite3_step(s))) {
+					if (!cb) {
+						continue;
+					}
+					const int n = s.column_count();
+					if (cols.empty()) {
+						cols.resize(2 * n);
+						for (int j = 0; j < n; ++j) {
+							cols[n + j] = (char*)s.column_name(j);
+						}
+					}
+					for (int j = 0; j < n; ++j) {
+						cols[j] = (char*)s.column_text(j);
+					}
+					if (cb(data, n, cols.data(), cols.data() + n)) {
+						throw_error(SQLITE_ABORT, nullptr, sql);
+					}
+				}
+				if (ret != SQLITE_DONE) {
+					throw_error(ret, pdb, sql);
+				}
+			}
+			catch (const exception& ex) {
+				if (!perrmsg) {
+					perrmsg = sqlite3_mprintf("%s", ex.errmsg());
+				}
+				throw;
+			}
+
+			return SQLITE_OK;
+		}
+
+		// https://sqlite.org/c3ref/errcode.html
+		int errcode() const
+		{
+			return sqlite3_errcode(pdb);
+		}
+		int extended_errcode() const
+		{
+			return sqlite3_extended_errcode(pdb);
+		}
+		const char* errmsg() const
+		{
+			return sqlite3_errmsg(pdb);
+		}
+		const void* errmsg16() const
+		{
+			return sqlite3_errmsg16(pdb);
+		}
+		static const char* errstr(int i)
+		{
+			return sqlite3_errstr(i);
+		}
+		int error_offset() const
+		{
+			return sqlite3_error_offset(pdb);
+		}
+
+	};
+
+	// Apply pragma settings and restore the previous values when it goes out of scope.
+	// { sqlite::scoped_pragmas p(db, sqlite::pragma_profile::bulk_load); ... }
+	class scoped_pragmas {
+		db& d;
+		pragma_settings prev;
+	public:
+		scoped_pragmas(db& d, const pragma_settings& ps)
+			: d{ d }, prev{ d.apply(ps) }
+		{ }
+		scoped_pragmas(db& d, pragma_profile p)
+			: scoped_pragmas(d, profile_settings(p))
+		{ }
+		scoped_pragmas(const scoped_pragmas&) = delete;
+		scoped_pragmas& operator=(const scoped_pragmas&) = delete;
+		~scoped_pragmas()
+		{
+			try {
+				d.apply(prev);
+			}
+			catch (...) {
+				// best effort
+			}
+		}
+
+		const pragma_settings& previous() const
+		{
+			return prev;
+		}
+	};
+
+	// Fast loading of tables. Applies the bulk_load profile with foreign keys off
+	// and drops the secondary indexes of tables, recording their DDL.
+	// finish() or the destructor recreates the indexes, checks foreign keys,
+	// runs ANALYZE, and restores the previous settings.
+	class scoped_bulk_load {
+		db& d;
+		std::vector<std::string> tables;
+		std::vector<std::pair<std::string, std::string>> indexes; // name, CREATE INDEX
+		pragma_settings prev;
+		bool active = false;
+
+		void drop_indexes()
+		{
+			stmt s(d);
+			s.prepare("SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = ? AND sql IS NOT NULL");
+			for (const auto& t : tables) {
+				s.reset();
+				s.bind(1, std::string_view(t));
+				while (SQLITE_ROW == s.step()) {
+					indexes.emplace_back(s.column<std::string>(0), s.column<std::string>(1));
+				}
+			}
+			s.reset();
+			for (size_t i = 0; i < indexes.size(); ++i) {
+				try {
+					d.exec(("DROP INDEX " + table_name(indexes[i].first)).c_str());
+				}
+				catch (...) {
+					indexes.resize(i); // only recreate the ones dropped
+					throw;
+				}
+			}
+		}
+		// Recreate indexes, check foreign keys, and analyze. Returns the first error.
+		std::exception_ptr rebuild() noexcept
+		{
+			std::exception_ptr error;
+			auto attempt = [&error](auto&& f) {
+				try {
+					f();
+				}
+				catch (...) {
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			};
+
+			for (const auto& [name, sql] : indexes) {
+				attempt([&] { d.exec(sql.c_str()); });
+			}
+			indexes.clear();
+			for (const auto& t : tables) {
+				attempt([&] {
+					stmt s(d);
+					s.prepare("PRAGMA foreign_key_check(" + table_name(t) + ")");
+					if (SQLITE_ROW == s.step()) {
+						throw std::runtime_error(fms::error("sqlite::bulk_load: foreign key violation").at(t).what());
+					}
+				});
+				attempt([&] { d.exec(("ANALYZE " + table_name(t)).c_str()); });
+			}
+
+			return error;
+		}
+	public:
+		scoped_bulk_load(db& d, std::vector<std::string> tables)
+			: d{ d }, tables{ std::move(tables) }
+		{
+			auto ps = profile_settings(pragma_profile::bulk_load);
+			ps.foreign_keys = 0;
+			prev = d.apply(ps);
+			try {
+				drop_indexes();
+			}
+			catch (...) {
+				rebuild();
+				d.apply(prev);
+				throw;
+			}
+			active = true;
+		}
+		scoped_bulk_load(const scoped_bulk_load&) = delete;
+		scoped_bulk_load& operator=(const scoped_bulk_load&) = delete;
+		~scoped_bulk_load()
+		{
+			try {
+				finish();
+			}
+			catch (...) {
+				// call finish() to see errors
+			}
+		}
+
+		// Dropped indexes as (name, CREATE INDEX ...).
+		const std::vector<std::pair<std::string, std::string>>& dropped() const
+		{
+			return indexes;
+		}
+
+		// Leave bulk-load mode. Settings are restored even if rebuilding fails.
+		void finish()
+		{
+			if (!active) {
+				return;
+			}
+			active = false;
+
+			std::exception_ptr error = rebuild();
+			try {
+				d.apply(prev);
+			}
+			catch (...) {
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	};
+
+	template<class... T>
+	inline scoped_bulk_load db::bulk_load(const T&... tables)
+	{
+		return scoped_bulk_load(*this, std::vector<std::string>{ std::string(tables)... });
+	}
+
+	enum class transaction_mode {
+		deferred,
+		immediate,
+		exclusive,
+	};
+
+	// Execute prepared statement as a transaction.
+	// Consumes stmt, commit if succesfull, rollback otherwise.
+	// https://sqlite.org/lang_transaction.html
+	inline int transact(stmt& s, transaction_mode mode = transaction_mode::deferred)
+	{
+		stmt t;
+
+		const char* trans;
+		switch (mode) {
+		case transaction_mode::immediate:
+			trans = "BEGIN TRANSACTION IMMEDIATE;";
+			break;
+		case transaction_mode::exclusive:
+			trans = "BEGIN TRANSACTION EXCLUSIVE;";
+			break;
+		case transaction_mode::deferred:
+		default:
+			trans = "BEGIN TRANSACTION DEFERRED;";
+			break;
+		}
+		FMS_SQLITE_ERRMSG(s.db_handle(), sqlite3_exec(s.db_handle(), trans, 0, 0, 0));
 		
 		try {
 			while (SQLITE_ROW == s.step())
 				;
 		}
-		catch (const std::exception& ex) {
-			int ret = sqlite3_exec(s.db_handle(), "ROLLBACK TRANSACTION;", 0, 0, 0);
-			if (SQLITE_OK != ret) {
-				throw std::runtime_error(fms::error(ex.what()).what());
-			}
+		catch (...) {
+			// never commit after a rollback
+			sqlite3_exec(s.db_handle(), "ROLLBACK TRANSACTION;", 0, 0, 0);
+			throw;
 		}
-		FMS_SQLITE_ERRSTR(sqlite3_exec(s.db_handle(), "COMMIT TRANSACTION;", 0, 0, 0));
+		FMS_SQLITE_ERRMSG(s.db_handle(), sqlite3_exec(s.db_handle(), "COMMIT TRANSACTION;", 0, 0, 0));
 
 		return s.last(); 
 	}
 
+	// Call f() as a transaction, or as a savepoint inside an open transaction.
+	// Commit if it returns, rollback and rethrow if it throws.
+	template<class F>
+	auto transact(sqlite3* pdb, F&& f, transaction_mode mode = transaction_mode::deferred)
+	{
+		const bool nested = !sqlite3_get_autocommit(pdb);
+		const char* trans;
+		switch (mode) {
+		case transaction_mode::immediate:
+			trans = "BEGIN TRANSACTION IMMEDIATE;";
+			break;
+		case transaction_mode::exclusive:
+			trans = "BEGIN TRANSACTION EXCLUSIVE;";
+			break;
+		case transaction_mode::deferred:
+		default:
+			trans = "BEGIN TRANSACTION DEFERRED;";
+			break;
+		}
+		if (nested) {
+			trans = "SAVEPOINT fms_sqlite;";
+		}
+		FMS_SQLITE_ERRMSG(pdb, sqlite3_exec(pdb, trans, 0, 0, 0));
+
+		auto commit = [pdb, nested]() {
+			FMS_SQLITE_ERRMSG(pdb, sqlite3_exec(pdb, nested ? "RELEASE fms_sqlite;" : "COMMIT TRANSACTION;", 0, 0, 0));
+		};
+		try {
+			if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+				f();
+				commit();
+			}
+			else {
+				auto result = f();
+				commit();
+
+				return result;
+			}
+		}
+		catch (...) {
+			if (!sqlite3_get_autocommit(pdb)) {
+				sqlite3_exec(pdb, nested ? "ROLLBACK TO fms_sqlite; RELEASE fms_sqlite;" : "ROLLBACK TRANSACTION;", 0, 0, 0);
+			}
+			throw;
+		}
+	}
+
+	// RAII transaction using statements from the db cache.
+	// Inside another transaction it is a SAVEPOINT that commit() releases.
+	// Rolls back in the destructor unless committed.
+	// { sqlite::transaction t(db, transaction_mode::immediate); ...; t.commit(); }
+	// https://sqlite.org/lang_savepoint.html
+	class transaction {
+		db& d;
+		bool nested;
+		bool done = false;
+
+		void run(const char* sql)
+		{
+			auto s = d.cached(sql);
+			s.step();
+		}
+	public:
+		transaction(db& d, transaction_mode mode = transaction_mode::deferred)
+			: d{ d }, nested{ !sqlite3_get_autocommit(d) }
+		{
+			if (nested) {
+				run("SAVEPOINT fms_sqlite"); // same name nests, RELEASE and ROLLBACK TO use the latest
+			}
+			else if (mode == transaction_mode::immediate) {
+				run("BEGIN IMMEDIATE");
+			}
+			else if (mode == transaction_mode::exclusive) {
+				run("BEGIN EXCLUSIVE");
+			}
+			else {
+				run("BEGIN");
+			}
+		}
+		transaction(const transaction&) = delete;
+		transaction& operator=(const transaction&) = delete;
+		~transaction()
+		{
+			if (!done) {
+				try {
+					rollback();
+				}
+				catch (...) {
+					// already rolled back by SQLite
+				}
+			}
+		}
+
+		bool is_nested() const
+		{
+			return nested;
+		}
+		// A failed COMMIT leaves the transaction active, the destructor rolls it back.
+		void commit()
+		{
+			run(nested ? "RELEASE fms_sqlite" : "COMMIT");
+			done = true;
+		}
+		void rollback()
+		{
+			done = true;
+			if (nested) {
+				run("ROLLBACK TO fms_sqlite");
+				run("RELEASE fms_sqlite");
+			}
+			else if (!sqlite3_get_autocommit(d)) {
+				run("ROLLBACK");
+			}
+		}
+	};
+
+	// Retries for transact_retry.
+	struct retry_policy {
+		int attempts = 10;                           // including the first
+		std::chrono::microseconds base{ 1'000 };     // first backoff
+		std::chrono::microseconds cap{ 100'000 };    // largest backoff
+	};
+
+	// Call f() in a transaction, running it again if it fails with SQLITE_BUSY,
+	// including SQLITE_BUSY_SNAPSHOT. Sleeps a random time up to base * 2^attempt, at most cap.
+	template<class F>
+	auto transact_retry(db& d, F&& f, transaction_mode mode = transaction_mode::immediate, retry_policy policy = {})
+	{
+		thread_local std::minstd_rand rng{ std::random_device{}() };
+
+		for (int attempt = 1; ; ++attempt) {
+			std::optional<transaction> t;
+			try {
+				t.emplace(d, mode);
+				if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+					f();
+					t->commit();
+
+					return;
+				}
+				else {
+					auto result = f();
+					t->commit();
+
+					return result;
+				}
+			}
+			catch (const busy&) {
+				if (attempt >= policy.attempts or (t and t->is_nested())) {
+					throw;
+				}
+			}
+			t.reset();
+
+			const auto limit = std::min(policy.cap.count(), policy.base.count() << std::min(attempt - 1, 20));
+			std::this_thread::sleep_for(std::chrono::microseconds(
+				std::uniform_int_distribution<long long>(0, limit)(rng)));
+		}
+	}
+
 } // sqlite
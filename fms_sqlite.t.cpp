@@ -1,9 +1,19 @@
 // fms_sqlite.t.cpp - test platform independent sqlite
 #include <cassert>
+#include <chrono>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <iterator>
 #include <sstream>
 #include "fms_sqlite.h"
+#include "fms_sqlite_insert.h"
+#include "fms_sqlite_arrow.h"
+#include "fms_sqlite_prefetch.h"
+#include "fms_sqlite_async.h"
+#include "fms_sqlite_pool.h"
+#include "fms_sqlite_writer.h"
+#include "fms_sqlite_durable.h"
 
 using namespace sqlite;
 
@@ -60,6 +70,1630 @@ int test_simple()
 	return 0;
 }
 
+int test_stmt_cache()
+{
+	try {
+		sqlite::db db("");
+		db.cache.capacity(2);
+		db.exec("CREATE TABLE t (a INT)");
+		assert(db.cache.misses() == 1);
+
+		for (int i = 0; i < 3; ++i) {
+			auto stmt = db.cached("INSERT INTO t VALUES (?)");
+			stmt.bind(1, i);
+			assert(SQLITE_DONE == stmt.step());
+		}
+		assert(db.cache.misses() == 2);
+		assert(db.cache.hits() == 2);
+		{
+			// returned reset and cleared
+			auto stmt = db.cached("INSERT INTO t VALUES (?)");
+			assert(!stmt.busy());
+			assert(SQLITE_DONE == stmt.step());
+			// concurrent lease of same sql gets its own statement
+			auto stmt2 = db.cached("INSERT INTO t VALUES (?)");
+			assert(stmt != stmt2);
+		}
+		{
+			auto stmt = db.cached("SELECT count(*), count(a) FROM t");
+			assert(SQLITE_ROW == stmt.step());
+			assert(stmt[0] == 4);
+			assert(stmt[1] == 3); // last insert bound NULL
+		}
+		db.exec("SELECT 1;");
+		assert(db.cache.size() == 2);
+		assert(db.cache.evictions() == 2);
+
+		// multiple statements use sqlite3_exec
+		db.exec("DELETE FROM t; INSERT INTO t VALUES (1)");
+		assert(db.cache.size() == 2);
+
+		// perrmsg is set on both paths
+		for (const char* sql : { "INSERT INTO u VALUES (1)", "SELECT 1; INSERT INTO u VALUES (1)" }) {
+			try {
+				db.exec(sql);
+				assert(false);
+			}
+			catch (const std::exception&) {
+				assert(db.perrmsg and std::string_view(db.perrmsg) == "no such table: u");
+			}
+		}
+		db.exec("SELECT 1");
+		assert(!db.perrmsg);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_stmt_t()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d DATETIME)");
+
+		stmt_t<"INSERT INTO t VALUES (?, ?, :c, :d)", params<int64_t, double, std::string_view, datetime>> insert(db);
+		for (int64_t i = 0; i < 3; ++i) {
+			insert.bind_params(i, i / 2., "str", datetime(time_t(i)));
+			assert(SQLITE_DONE == insert.step());
+			insert.reset();
+		}
+		insert.bind<1>(3);
+		insert.bind<2>(1.5);
+		insert.bind<3>("s");
+		insert.step();
+
+		stmt_t<"SELECT a, b, c, d FROM t WHERE a >= ?", params<int>, columns<int64_t, double, std::string_view, datetime>> select(db);
+		select.bind<1>(1);
+		int n = 0;
+		while (SQLITE_ROW == select.step()) {
+			++n;
+			assert(select.column<0>() == n);
+			assert(select.column<1>() == n / 2.);
+		}
+		assert(n == 3);
+		assert(select.column<2>().empty());
+
+		// all parameters with types that also match stmt::bind overloads
+		stmt_t<"INSERT INTO t (a, b) VALUES (?, ?)", params<int, double>> insert2(db);
+		insert2.bind_params(10, 2.0);
+		assert(SQLITE_DONE == insert2.step());
+		stmt_t<"SELECT b FROM t WHERE a = ?", params<int>, columns<double>> select2(db);
+		select2.bind_params(10);
+		assert(SQLITE_ROW == select2.step());
+		assert(select2.column<0>() == 2.0);
+
+		try {
+			// column count checked at runtime
+			stmt_t<"SELECT a, b FROM t", params<>, columns<int>> bad(db);
+			assert(false);
+		}
+		catch (const std::runtime_error&) {
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_bind_view()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a TEXT)");
+
+		std::string_view abc("abcdef", 3); // not null terminated
+		sqlite::stmt stmt(db);
+		stmt.prepare(std::string_view("INSERT INTO t VALUES (?); trailing", 26));
+		assert(std::string_view(stmt.tail()).starts_with(" trailing"));
+		stmt.bind(1, abc);
+		assert(SQLITE_DONE == stmt.step());
+		stmt.reset();
+		stmt.bind(1, std::string_view{});
+		assert(SQLITE_DONE == stmt.step());
+		stmt.reset();
+		{
+			std::string buf("borrowed");
+			sqlite::stmt::borrowed_bindings b(stmt);
+			b.bind(1, buf);
+			assert(SQLITE_DONE == stmt.step());
+		}
+		// bindings cleared on scope exit
+		assert(SQLITE_DONE == stmt.step());
+
+		stmt.prepare("SELECT a FROM t");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == "abc");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0].type() == SQLITE_TEXT);
+		assert(stmt[0] == "");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == "borrowed");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0].type() == SQLITE_NULL);
+		assert(SQLITE_DONE == stmt.step());
+
+		// second argument is flags, not size
+		stmt.prepare("SELECT count(*) FROM t", SQLITE_PREPARE_PERSISTENT);
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == 4);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_bind_all()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d BOOLEAN)");
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("INSERT INTO t VALUES (?, ?, ?, ?)");
+		stmt.bind_all(1L, 1.5f, "one", true);
+		assert(SQLITE_DONE == stmt.step());
+		stmt.reset();
+
+		std::vector<std::tuple<int64_t, double, std::string, bool>> rows;
+		for (int i = 2; i <= 100; ++i) {
+			rows.emplace_back(i, i + .5, std::to_string(i), i % 2 == 0);
+		}
+		assert(stmt.execute_many(rows) == rows.size());
+
+		try {
+			stmt.bind_all(1, 2, 3, 4, 5); // too many
+			assert(false);
+		}
+		catch (const std::runtime_error&) {
+		}
+
+		stmt.prepare("SELECT count(*), sum(a), sum(d) FROM t");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == 100);
+		assert(stmt[1] == 5050);
+		assert(stmt[2] == 51);
+
+		// unsigned values are not narrowed to int
+		const uint32_t u32 = 3'000'000'000u;
+		const uint64_t u64 = std::numeric_limits<int64_t>::max();
+		stmt.prepare("SELECT ?, ?, -1");
+		stmt.bind_all(u32, u64);
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt.column<int64_t>(0) == 3'000'000'000);
+		assert(stmt.column<uint32_t>(0) == u32);
+		assert(stmt.column<uint64_t>(1) == u64);
+		try {
+			stmt.column<uint64_t>(2);
+			assert(false);
+		}
+		catch (const sqlite::exception& ex) {
+			assert(ex.code() == SQLITE_MISMATCH);
+			assert(std::string_view(ex.errmsg()).starts_with("column -1:"));
+			assert(ex.sql() == "SELECT ?, ?, -1");
+		}
+		stmt.reset();
+		try {
+			stmt.bind_all(u32, u64 + 1); // does not fit in int64
+			assert(false);
+		}
+		catch (const sqlite::exception& ex) {
+			assert(ex.code() == SQLITE_MISMATCH);
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_bulk_insert()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT)");
+
+		constexpr size_t n = 1000;
+		std::vector<int64_t> a(n);
+		std::vector<double> b(n);
+		std::vector<std::string> s(n);
+		std::vector<std::string_view> c(n);
+		for (size_t i = 0; i < n; ++i) {
+			a[i] = i;
+			b[i] = i / 2.;
+			s[i] = std::to_string(i);
+			c[i] = s[i];
+		}
+
+		sqlite::bulk_insert<int64_t, double, std::string_view> ins(db, "t", 300);
+		assert(ins.rows_per_insert() > 1); // multi-row VALUES by default
+		auto stats = ins(std::span(a), std::span(b), std::span(c));
+		assert(stats.rows == n);
+		assert(stats.batches == 4);
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT count(*), sum(a), max(c) FROM t");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == (int)n);
+		assert(stmt[1] == (int)(n * (n - 1) / 2));
+		assert(stmt[2] == "999");
+
+		try {
+			ins(std::span(a), std::span(b).first(1), std::span(c));
+			assert(false);
+		}
+		catch (const std::runtime_error&) {
+		}
+
+		// inside the caller's transaction
+		db.exec("BEGIN");
+		ins(std::span(a), std::span(b), std::span(c));
+		db.exec("ROLLBACK");
+		stmt.prepare("SELECT count(*) FROM t");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == (int)n);
+
+		// multi-row VALUES with extended types
+		db.exec("CREATE TABLE u (a BOOLEAN, b DATETIME)");
+		bool e[] = { true, false, true, true, false, true, true };
+		datetime f[] = { datetime(time_t(0)), datetime(1.5), datetime("2023-04-05"),
+			datetime(time_t(3)), datetime(time_t(4)), datetime(time_t(5)), datetime(time_t(6)) };
+		sqlite::bulk_insert<bool, datetime> ins2(db, "u", 5);
+		ins2.rows_per_insert(2); // chunks of 2, 2, 1 then 2
+		stats = ins2(std::span(e), std::span(f));
+		assert(stats.rows == 7);
+		ins2.rows_per_insert(0);
+		assert(ins2.rows_per_insert() > 1);
+
+		stmt.prepare("SELECT count(*), sum(a), typeof(b) FROM u WHERE rowid = 3");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == 1);
+		assert(stmt[2] == "text");
+		stmt.prepare("SELECT sum(a), sum(b = 6) FROM u");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == 5);
+		assert(stmt[1] == 1);
+
+		// column names are copied, later statements do not read the caller's strings
+		std::optional<sqlite::bulk_insert<bool, datetime>> ins3;
+		{
+			std::vector<std::string> cols{ "b", "a" };
+			std::vector<std::string_view> views(cols.begin(), cols.end());
+			ins3.emplace(db, "u", 10, views);
+		}
+		ins3->rows_per_insert(3);
+		(*ins3)(std::span(e).first(3), std::span(f).first(3));
+		stmt.prepare("SELECT count(*) FROM u");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt[0] == 10);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_names()
+{
+	try {
+		sqlite::db db("");
+		sqlite::stmt stmt(db);
+
+		stmt.prepare("SELECT :a AS a, @b AS b, $c AS c, :a AS a2, 1 AS a");
+		assert(stmt.bind_parameter_count() == 3);
+		assert(stmt.bind_parameter_index(std::string_view("@b")) == 2);
+		assert(stmt.bind_parameter_index(std::string_view("b")) == 0);
+		stmt[":a"] = 1;
+		stmt["@b"] = 2.5;
+		stmt[std::string_view("$c")] = "c";
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt.column_index("a") == 0); // first of duplicate names
+		assert(stmt.column_index("a2") == 3);
+		assert(stmt.column_index("d") == -1);
+		assert(stmt["a"] == 1);
+		assert(stmt["b"] == 2.5);
+		assert(stmt[std::string_view("c")] == "c");
+		assert(stmt["a2"] == 1);
+
+		// names are rebuilt after prepare
+		stmt.prepare("SELECT 2 AS d");
+		assert(SQLITE_ROW == stmt.step());
+		assert(stmt.column_index("a") == -1);
+		assert(stmt["d"] == 2);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_metadata()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b BOOLEAN, c DATETIME, d)");
+		db.exec("INSERT INTO t VALUES (1, TRUE, '2023-04-05', 1.5)");
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b, c AS e, d, 1.5 FROM t");
+		assert(SQLITE_ROW == stmt.step());
+		const auto& m = stmt.metadata();
+		assert(m.size() == 5);
+		assert(m[0].name == "a" and m[0].decl == "INT" and m[0].affinity == SQLITE_INTEGER);
+		assert(m[1].extended_type == SQLITE_BOOLEAN);
+		assert(m[2].name == "e" and m[2].type == SQLITE_NUMERIC and m[2].extended_type == SQLITE_DATETIME);
+#ifdef SQLITE_ENABLE_COLUMN_METADATA
+		assert(m[2].table == "t" and m[2].origin == "c");
+#endif
+		assert(m[3].decl.empty() and m[3].affinity == SQLITE_BLOB);
+		assert(stmt.sql_extended_type(1) == SQLITE_BOOLEAN);
+		assert(stmt.sql_type(3) == SQLITE_FLOAT); // no declared type so use value type
+		assert(stmt.sql_type(4) == SQLITE_FLOAT);
+		assert(m[4].type == SQLITE_UNKNOWN);
+
+		stmt.prepare("SELECT a FROM t");
+		assert(stmt.metadata().size() == 1);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+struct row_abcd {
+	int64_t a;
+	double b;
+	std::string c;
+	datetime d;
+};
+static_assert(sqlite::aggregate_size<row_abcd>() == 4);
+
+int test_row()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d DATETIME)");
+		db.exec("INSERT INTO t VALUES (1, 1.5, 'one', 86400)");
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b, c, d FROM t");
+		assert(SQLITE_ROW == stmt.step());
+
+		auto [a, b, c, d] = stmt.row<int64_t, double, std::string_view, datetime>();
+		assert(a == 1 and b == 1.5 and c == "one" and d == datetime(time_t(86400)));
+
+		row_abcd r;
+		stmt.row_into(r);
+		assert(r.a == 1 and r.b == 1.5 and r.c == "one" and r.d == d);
+
+		struct { int a; double b; } too_few;
+		try {
+			stmt.row_into(too_few);
+			assert(false);
+		}
+		catch (const std::runtime_error&) {
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_rows()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b TEXT)");
+		db.exec("INSERT INTO t VALUES (1, 'one'), (2, 'two'), (3, 'three'), (4, 'four')");
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b FROM t ORDER BY a");
+
+		int n = 0;
+		for (auto row : stmt.rows()) {
+			++n;
+			assert(row.size() == 2);
+			assert(row[0] == n);
+			assert(row.get<int>(0) == n);
+			assert(row["b"].column_text_view() == row.get<std::string_view>(1));
+			auto [a, b] = row.as<int, std::string_view>();
+			assert(a == n and b == row[1].column_text_view());
+			int j = 0;
+			for (auto col : row) {
+				assert(col.type() == (j++ == 0 ? SQLITE_INTEGER : SQLITE_TEXT));
+			}
+		}
+		assert(n == 4);
+
+		// take does not step past the last row taken
+		stmt.reset();
+		n = 0;
+		for (auto row : stmt.rows() | std::views::take(2)) {
+			assert(row[0] == ++n);
+		}
+		assert(n == 2 and stmt.column_int(0) == 2);
+
+		stmt.reset();
+		auto even = stmt.rows()
+			| std::views::filter([](auto row) { return row.template get<int>(0) % 2 == 0; })
+			| std::views::transform([](auto row) { return row.template get<int>(0); });
+		n = 0;
+		for (int a : even) {
+			assert(a == 2 * ++n);
+		}
+		assert(n == 2);
+
+		stmt.prepare("SELECT a FROM t WHERE a > 10");
+		assert(stmt.rows().begin() == std::default_sentinel);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_fetch_batch()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d BOOLEAN, e)");
+		sqlite::stmt stmt(db);
+		stmt.prepare("INSERT INTO t VALUES (?, ?, ?, ?, ?)");
+		for (int i = 0; i < 10; ++i) {
+			stmt.bind_all(i, i * 0.5, std::to_string(i), i % 2 == 0, i * 0.25);
+			if (i == 3) {
+				stmt.bind(3); // NULL
+			}
+			stmt.step();
+			stmt.reset();
+		}
+
+		stmt.prepare("SELECT a, b, c, d, e FROM t");
+		sqlite::batch b;
+		size_t rows = 0, batches = 0;
+		while (size_t n = stmt.fetch_batch(b, 4)) {
+			assert(b.rows == n and n <= 4);
+			assert(b[0].type == SQLITE_INTEGER and b[1].type == SQLITE_FLOAT);
+			assert(b[2].type == SQLITE_TEXT and b[3].type == SQLITE_INTEGER and b[4].type == SQLITE_FLOAT);
+			for (size_t i = 0; i < n; ++i) {
+				const auto r = rows + i;
+				assert(b[0].integer[i] == (int64_t)r);
+				assert(b[1].real[i] == r * 0.5);
+				assert(b[2].is_null(i) == (r == 3));
+				assert(r == 3 or b[2].text(i) == std::to_string(r));
+				assert(b[3].integer[i] == (r % 2 == 0));
+				assert(b[4].real[i] == r * 0.25);
+			}
+			rows += n;
+			++batches;
+		}
+		assert(rows == 10 and batches == 3);
+		assert(stmt.fetch_batch(b, 4) == 0);
+
+		stmt.reset();
+		auto b2 = stmt.fetch_batch(100);
+		assert(b2.rows == 10);
+		assert(b2[2].nulls == 1);
+
+		// a new statement after SQLITE_DONE is stepped
+		assert(stmt.fetch_batch(b, 100) == 0);
+		stmt.prepare("SELECT a FROM t WHERE a < 5");
+		assert(stmt.fetch_batch(b, 100) == 5);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_prefetch()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT)");
+		db.exec("WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i < 999) "
+			"INSERT INTO t SELECT i FROM c");
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a FROM t ORDER BY a");
+		{
+			sqlite::prefetch p(stmt, 64, 2);
+			int64_t sum = 0;
+			size_t rows = 0;
+			while (const sqlite::batch* b = p.next()) {
+				assert(b->rows <= 64);
+				for (size_t i = 0; i < b->rows; ++i) {
+					assert((*b)[0].integer[i] == (int64_t)(rows + i));
+					sum += (*b)[0].integer[i];
+				}
+				rows += b->rows;
+			}
+			assert(rows == 1000 and sum == 999 * 1000 / 2);
+			assert(!p.next());
+		}
+		// cancel resets the statement
+		stmt.reset();
+		{
+			sqlite::prefetch p(stmt, 10, 3);
+			const sqlite::batch* b = p.next();
+			assert(b and b->rows == 10);
+			p.cancel();
+			assert(!p.next());
+		}
+		assert(stmt.step() == SQLITE_ROW and stmt.column_int(0) == 0);
+		stmt.reset();
+		// producer errors are rethrown by the consumer
+		stmt.prepare("SELECT abs(a - 9223372036854775807 - 1) FROM t WHERE a = 0");
+		{
+			sqlite::prefetch p(stmt);
+			bool thrown = false;
+			try {
+				p.next();
+			}
+			catch (const std::exception&) {
+				thrown = true;
+			}
+			assert(thrown);
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+// Coroutine that starts eagerly and is not awaited.
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() { }
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+int test_async()
+{
+	try {
+		// resume coroutines on this thread
+		std::mutex m;
+		std::condition_variable cv;
+		std::deque<std::coroutine_handle<>> ready;
+		auto post = [&](std::coroutine_handle<> h) {
+			{
+				std::lock_guard lock(m);
+				ready.push_back(h);
+			}
+			cv.notify_one();
+		};
+
+		sqlite::db db1(""), db2("");
+		sqlite::executor ex1(db1, post), ex2(db2, post);
+		int done = 0;
+
+		auto query = [&done](sqlite::executor& ex, sqlite::db& db, int n) -> detached {
+			co_await ex.async_exec("CREATE TABLE t (a INT)");
+			for (int i = 0; i < n; ++i) {
+				co_await ex.async_exec("INSERT INTO t VALUES (" + std::to_string(i) + ")");
+			}
+			sqlite::stmt stmt(db);
+			co_await ex.async([&stmt]() { stmt.prepare("SELECT count(*), sum(a) FROM t"); });
+			assert(SQLITE_ROW == co_await ex.async_step(stmt));
+			assert(stmt.column_int(0) == n and stmt.column_int(1) == n * (n - 1) / 2);
+			assert(SQLITE_DONE == co_await ex.async_step(stmt));
+			bool thrown = false;
+			try {
+				co_await ex.async_exec("SELECT * FROM missing");
+			}
+			catch (const std::exception&) {
+				thrown = true;
+			}
+			assert(thrown);
+			++done;
+		};
+		query(ex1, db1, 10);
+		query(ex2, db2, 20);
+
+		while (done < 2) {
+			std::unique_lock lock(m);
+			cv.wait(lock, [&ready] { return !ready.empty(); });
+			auto h = ready.front();
+			ready.pop_front();
+			lock.unlock();
+			h.resume();
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_pool()
+{
+	const char* file = "pool.db";
+	try {
+		sqlite::pool p(file, 2);
+		assert(p.size() == 2);
+		{
+			auto w = p.writer();
+			w->exec("DROP TABLE IF EXISTS t");
+			w->exec("CREATE TABLE t (a INT)");
+			w->exec("INSERT INTO t VALUES (1), (2), (3)");
+		}
+		{
+			auto r = p.reader();
+			bool thrown = false;
+			try {
+				r->exec("INSERT INTO t VALUES (4)");
+			}
+			catch (const std::exception&) {
+				thrown = true;
+			}
+			assert(thrown);
+		}
+		{
+			sqlite::db* d;
+			{
+				auto r = p.reader();
+				d = &*r;
+			}
+			auto r = p.reader();
+			assert(d == &*r); // same thread gets the same connection
+		}
+
+		std::vector<std::thread> threads;
+		std::atomic<int> sum = 0;
+		for (int k = 0; k < 4; ++k) {
+			threads.emplace_back([&p, &sum]() {
+				for (int i = 0; i < 50; ++i) {
+					auto r = p.reader();
+					auto s = r->cached("SELECT sum(a) FROM t WHERE a <= 3");
+					s.step();
+					sum += s.column_int(0);
+				}
+			});
+		}
+		threads.emplace_back([&p]() {
+			for (int i = 0; i < 50; ++i) {
+				auto w = p.writer();
+				w->exec("INSERT INTO t VALUES (10)");
+			}
+		});
+		for (auto& t : threads) {
+			t.join();
+		}
+		assert(sum == 4 * 50 * 6);
+
+		const auto stats = p.stats();
+		assert(stats.checkouts == 1 + 1 + 2 + 4 * 50 + 50);
+		assert(stats.affinity >= 1);
+		assert(stats.waits == 0 or stats.wait_seconds > 0);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("pool.db-wal");
+	std::remove("pool.db-shm");
+
+	return 0;
+}
+
+int test_writer()
+{
+	try {
+		sqlite::writer w("", 64, std::chrono::microseconds(2000));
+		w.submit([](sqlite::db& db) { db.exec("CREATE TABLE t (a INT UNIQUE, b TEXT)"); }).get();
+
+		std::vector<std::thread> threads;
+		std::vector<std::future<int>> results(400);
+		for (int k = 0; k < 4; ++k) {
+			threads.emplace_back([&w, &results, k]() {
+				for (int i = 0; i < 100; ++i) {
+					const int a = k * 100 + i;
+					results[a] = w.submit("INSERT INTO t VALUES (?, ?)", a, std::to_string(a));
+				}
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+		for (auto& r : results) {
+			assert(r.get() == 1);
+		}
+
+		// a failing job does not roll back the rest of its batch
+		auto ok1 = w.submit("INSERT INTO t VALUES (?, ?)", 1000, "x");
+		auto dup = w.submit("INSERT INTO t VALUES (?, ?)", 0, "dup");
+		auto ok2 = w.submit("INSERT INTO t VALUES (?, ?)", 1001, "y");
+		assert(ok1.get() == 1 and ok2.get() == 1);
+		bool thrown = false;
+		try {
+			dup.get();
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		auto count = w.submit([](sqlite::db& db) {
+			auto s = db.cached("SELECT count(*) FROM t");
+			s.step();
+			return s.column_int(0);
+		});
+		assert(count.get() == 402);
+
+		const auto stats = w.stats();
+		assert(stats.jobs == 1 + 400 + 3 + 1);
+		assert(stats.failed == 1);
+		assert(stats.batches < stats.jobs);
+		assert(stats.largest <= 64);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	try {
+		// every future completes with the error if the transaction fails
+		sqlite::writer w("", 2, std::chrono::milliseconds(200));
+		w.submit([](sqlite::db& db) {
+			db.exec("CREATE TABLE p (id INTEGER PRIMARY KEY)");
+			db.exec("CREATE TABLE c (pid INT REFERENCES p(id) DEFERRABLE INITIALLY DEFERRED)");
+		}).get();
+
+		// COMMIT fails on a deferred foreign key violation
+		// shared futures keep the results, and the exceptions, owned by this thread
+		auto bad = w.submit("INSERT INTO c VALUES (?)", 99).share();
+		auto good = w.submit("INSERT INTO p VALUES (?)", 1).share();
+		for (auto* f : { &bad, &good }) {
+			try {
+				f->get();
+				assert(false);
+			}
+			catch (const sqlite::constraint& ex) {
+				assert(ex.code() == SQLITE_CONSTRAINT_FOREIGNKEY);
+			}
+		}
+
+		// a job ends the transaction, later jobs in the batch get its error
+		auto broken = w.submit([](sqlite::db& db) {
+			db.exec("ROLLBACK");
+			throw std::runtime_error("job");
+		}).share();
+		auto pending = w.submit("INSERT INTO p VALUES (?)", 2).share();
+		for (auto* f : { &broken, &pending }) {
+			try {
+				f->get();
+				assert(false);
+			}
+			catch (const std::runtime_error& ex) {
+				assert(std::string_view(ex.what()) == "job");
+			}
+		}
+		assert(w.stats().failed == 4);
+
+		// OR ROLLBACK ends the transaction, the job keeps its own error
+		w.submit("INSERT INTO p VALUES (?)", 5).get();
+		auto first = w.submit("INSERT INTO p VALUES (?)", 6).share();
+		auto conflict = w.submit("INSERT OR ROLLBACK INTO p VALUES (?)", 5).share();
+		for (auto* f : { &first, &conflict }) {
+			try {
+				f->get();
+				assert(false);
+			}
+			catch (const sqlite::constraint& ex) {
+				assert(ex.code() == SQLITE_CONSTRAINT_PRIMARYKEY);
+			}
+		}
+		assert(w.stats().failed == 6);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_durability()
+{
+	const char* file = "durable.db";
+	try {
+		sqlite::db db(file);
+		db.default_pragmas();
+		db.exec("DROP TABLE IF EXISTS t");
+		db.exec("CREATE TABLE t (a INT)");
+		db.exec("PRAGMA wal_autocheckpoint=500");
+		{
+			sqlite::durability d(db, std::chrono::milliseconds(60'000));
+			const auto c0 = d.commits();
+			auto t1 = d.commit([&db]() { db.exec("INSERT INTO t VALUES (1)"); });
+			auto t2 = d.commit([&db]() { db.exec("INSERT INTO t VALUES (2)"); });
+			assert(t1.sequence() == c0 + 1 and t2.sequence() == c0 + 2);
+			assert(!t2.is_durable()); // interval has not elapsed and nobody waited
+
+			t1.wait_durable();
+			assert(t1.is_durable() and t2.is_durable()); // one sync covers both
+			assert(d.syncs() == 1);
+
+			auto t3 = d.commit([&db]() { db.exec("INSERT INTO t VALUES (3)"); });
+			std::thread waiter([&t3]() { t3.wait_durable(); });
+			waiter.join();
+			assert(t3.is_durable() and d.syncs() == 2);
+
+			// no WAL commit, nothing to wait for
+			auto t4 = d.commit([&db]() { db.exec("SELECT count(*) FROM t"); });
+			assert(t4.sequence() == 0 and t4.is_durable());
+			// ticket is for this commit, not a later one on the connection
+			auto t5 = d.commit([&db]() { db.exec("INSERT INTO t VALUES (4)"); });
+			std::thread([&]() { d.commit([&db]() { db.exec("INSERT INTO t VALUES (5)"); }); }).join();
+			assert(t5.sequence() == c0 + 4 and d.last().sequence() == c0 + 5);
+		}
+		assert(db.pragma<int>("wal_autocheckpoint") == 500);
+		sqlite::stmt s(db);
+		s.prepare("SELECT count(*) FROM t");
+		s.step();
+		assert(s.column_int(0) == 5);
+
+		sqlite::db mem("");
+		bool thrown = false;
+		try {
+			sqlite::durability d(mem);
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("durable.db-wal");
+	std::remove("durable.db-shm");
+
+	return 0;
+}
+
+int test_pragma_profile()
+{
+	const char* file = "profile.db";
+	try {
+		sqlite::db db(file);
+		db.default_pragmas();
+		assert(db.pragma<std::string>("journal_mode") == "wal");
+		assert(db.pragma<int>("synchronous") == 1);
+		assert(db.pragma<sqlite3_int64>("cache_size") == -20000);
+
+		const auto defaults = sqlite::profile_settings(sqlite::pragma_profile::oltp);
+		assert(defaults.journal_mode == "WAL" and defaults.synchronous == 1 and defaults.temp_store == 2);
+		assert(defaults.cache_size == -20000 and defaults.mmap_size == 2147483648);
+		assert(!sqlite::pragma_settings{}.set("page_size", "8192"));
+		const auto oltp = db.pragmas(defaults);
+		assert(oltp.journal_mode == "wal" and oltp.foreign_keys == 1);
+		{
+			sqlite::scoped_pragmas p(db, sqlite::pragma_profile::bulk_load);
+			assert(p.previous().synchronous == 1);
+			assert(db.pragma<std::string>("journal_mode") == "off");
+			assert(db.pragma<int>("synchronous") == 0);
+			assert(db.pragma<sqlite3_int64>("cache_size") == -1'000'000);
+			assert(db.pragma<std::string>("locking_mode") == "exclusive");
+			db.exec("CREATE TABLE u (a)");
+			db.exec("INSERT INTO u VALUES (1)");
+		}
+		assert(db.pragma<int>("synchronous") == 1);
+		{
+			// restored WAL is shared with other connections
+			sqlite::db other(file);
+			other.exec("INSERT INTO u VALUES (2)");
+			sqlite::stmt s(other);
+			s.prepare("SELECT count(*) FROM u");
+			s.step();
+			assert(s.column_int(0) == 2);
+		}
+
+		auto prev = db.apply(sqlite::pragma_profile::read_only);
+		assert(db.pragma<int>("query_only") == 1);
+		bool thrown = false;
+		try {
+			db.exec("CREATE TABLE t (a)");
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		assert(thrown);
+		db.apply(prev);
+		assert(db.pragma<int>("query_only") == 0);
+
+		// all or nothing
+		db.exec("BEGIN");
+		thrown = false;
+		try {
+			db.apply(sqlite::pragma_settings{ .journal_mode = "DELETE", .cache_size = -1234 });
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		db.exec("COMMIT");
+		assert(thrown);
+		assert(db.pragma<sqlite3_int64>("cache_size") == -20000);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("profile.db-wal");
+	std::remove("profile.db-shm");
+
+	return 0;
+}
+
+int test_bulk_load()
+{
+	const char* file = "bulk.db";
+	try {
+		sqlite::db db(file);
+		db.default_pragmas();
+		db.exec("DROP TABLE IF EXISTS c");
+		db.exec("DROP TABLE IF EXISTS p");
+		db.exec("CREATE TABLE p (id INTEGER PRIMARY KEY, name TEXT UNIQUE)");
+		db.exec("CREATE TABLE c (id INTEGER PRIMARY KEY, p INT REFERENCES p(id), x INT)");
+		db.exec("CREATE INDEX c_p ON c(p)");
+		db.exec("CREATE INDEX c_x ON c(x DESC)");
+
+		auto count = [&db](const char* sql) {
+			sqlite::stmt s(db);
+			s.prepare(sql);
+			s.step();
+			return s.column_int(0);
+		};
+		// another connection can write after bulk-load mode ends
+		auto other_insert = [file](int id) {
+			sqlite::db other(file);
+			sqlite::stmt s(other);
+			s.prepare("INSERT INTO p (id, name) VALUES (?, ?)");
+			s.bind_all(id, std::to_string(id));
+			return s.step() == SQLITE_DONE;
+		};
+		{
+			auto load = db.bulk_load("p", "c");
+			assert(load.dropped().size() == 2); // autoindex for UNIQUE is kept
+			assert(count("SELECT count(*) FROM sqlite_master WHERE type = 'index' AND sql IS NOT NULL") == 0);
+			assert(db.pragma<std::string>("journal_mode") == "off");
+			assert(db.pragma<int>("foreign_keys") == 0);
+			// child rows before parents are fine while loading
+			db.exec("INSERT INTO c (p, x) VALUES (1, 10), (2, 20)");
+			db.exec("INSERT INTO p (id, name) VALUES (1, 'a'), (2, 'b')");
+		}
+		assert(count("SELECT count(*) FROM sqlite_master WHERE type = 'index' AND sql IS NOT NULL") == 2);
+		assert(count("SELECT count(*) FROM sqlite_stat1 WHERE tbl = 'c'") > 0);
+		assert(db.pragma<std::string>("journal_mode") == "wal");
+		assert(db.pragma<int>("foreign_keys") == 1);
+		assert(other_insert(10));
+
+		// violations are reported by finish and settings are still restored
+		bool thrown = false;
+		{
+			auto load = db.bulk_load("c");
+			db.exec("INSERT INTO c (p, x) VALUES (3, 30)");
+			try {
+				load.finish();
+			}
+			catch (const std::exception&) {
+				thrown = true;
+			}
+			assert(other_insert(11));
+		}
+		assert(thrown);
+		assert(db.pragma<int>("foreign_keys") == 1);
+		assert(count("SELECT count(*) FROM sqlite_master WHERE name = 'c_x'") == 1);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("bulk.db-wal");
+	std::remove("bulk.db-shm");
+
+	return 0;
+}
+
+int test_ingest()
+{
+	const char* file = "ingest.db";
+	try {
+		sqlite::db db(file);
+		db.default_pragmas();
+		db.exec("DROP TABLE IF EXISTS t");
+		db.exec("CREATE TABLE t (a INT, b TEXT)");
+		sqlite::stmt stmt(db);
+		stmt.prepare("INSERT INTO t VALUES (?, ?)");
+		auto insert = [&stmt](int i) {
+			stmt.bind_all(i, std::to_string(i));
+			stmt.step();
+			stmt.reset();
+		};
+
+		sqlite::ingest in(db, std::chrono::milliseconds(5), 100);
+		in.limits(10, 100'000);
+		const auto& stats = in(std::views::iota(0, 20'000), insert);
+		assert(stats.rows == 20'000);
+		assert(stats.batches > 1 and stats.wal_pages > 0);
+		assert(stats.batch_size == in.batch_size());
+		assert(10 <= in.batch_size() and in.batch_size() <= 100'000);
+		assert(stats.rows_per_second() > 0);
+
+		// WAL limit shrinks batches
+		in.max_wal_pages(2);
+		in(std::views::iota(20'000, 30'000), insert);
+		assert(in.stats().last_wal_pages <= 4 or in.batch_size() == 10);
+
+		stmt.prepare("SELECT count(*) FROM t");
+		stmt.step();
+		assert(stmt.column_int(0) == 30'000);
+
+		// inside the caller's transaction batches are savepoints
+		stmt.prepare("INSERT INTO t VALUES (?, ?)");
+		db.exec("BEGIN");
+		in(std::views::iota(0, 100), insert);
+		db.exec("ROLLBACK");
+		stmt.prepare("SELECT count(*) FROM t");
+		stmt.step();
+		assert(stmt.column_int(0) == 30'000);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("ingest.db-wal");
+	std::remove("ingest.db-shm");
+
+	return 0;
+}
+
+int test_transaction()
+{
+	const char* file = "transaction.db";
+	try {
+		sqlite::db db(file);
+		db.default_pragmas();
+		db.exec("DROP TABLE IF EXISTS t");
+		db.exec("CREATE TABLE t (a INT UNIQUE)");
+		auto count = [&db]() {
+			auto s = db.cached("SELECT count(*) FROM t");
+			s.step();
+			return s.column_int(0);
+		};
+
+		{
+			sqlite::transaction t(db, sqlite::transaction_mode::immediate);
+			assert(!t.is_nested());
+			db.exec("INSERT INTO t VALUES (1)");
+			{
+				sqlite::transaction u(db);
+				assert(u.is_nested());
+				db.exec("INSERT INTO t VALUES (2)");
+				// rolled back by destructor
+			}
+			{
+				sqlite::transaction u(db);
+				db.exec("INSERT INTO t VALUES (3)");
+				u.commit();
+			}
+			t.commit();
+		}
+		assert(count() == 2);
+		{
+			sqlite::transaction t(db);
+			db.exec("INSERT INTO t VALUES (4)");
+		}
+		assert(count() == 2 and sqlite3_get_autocommit(db));
+
+		// transact(stmt&) rolls back and does not commit after an error
+		sqlite::stmt stmt(db);
+		stmt.prepare("INSERT INTO t VALUES (1)");
+		bool thrown = false;
+		try {
+			sqlite::transact(stmt);
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		assert(thrown and sqlite3_get_autocommit(db));
+
+		// retry while another connection holds the write lock
+		sqlite::db other(file);
+		other.exec("BEGIN IMMEDIATE");
+		std::thread holder([&other]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			other.exec("COMMIT");
+		});
+		db.pragma("busy_timeout", 0);
+		int attempts = 0;
+		const int n = sqlite::transact_retry(db, [&]() {
+			++attempts;
+			db.exec("INSERT INTO t VALUES (5)");
+			return count();
+		}, sqlite::transaction_mode::immediate, sqlite::retry_policy{ .attempts = 1000 });
+		holder.join();
+		assert(n == 3 and attempts >= 1);
+
+		// other errors are not retried
+		attempts = 0;
+		thrown = false;
+		try {
+			sqlite::transact_retry(db, [&]() {
+				++attempts;
+				db.exec("INSERT INTO t VALUES (5)");
+			});
+		}
+		catch (const std::exception&) {
+			thrown = true;
+		}
+		assert(thrown and attempts == 1 and count() == 3);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("transaction.db-wal");
+	std::remove("transaction.db-shm");
+
+	return 0;
+}
+
+int test_ingest_isolated()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT UNIQUE CHECK (a >= 0))");
+		std::vector<int> rows(1000);
+		for (int i = 0; i < 1000; ++i) {
+			rows[i] = i;
+		}
+		rows[17] = -1;  // CHECK
+		rows[500] = 3;  // UNIQUE
+		rows[999] = 998;
+
+		std::vector<size_t> rejected;
+		std::vector<std::string> messages;
+		const auto stats = sqlite::ingest_isolated(db, rows,
+			[&db](int a) {
+				auto s = db.cached("INSERT INTO t VALUES (?)");
+				s.bind(1, a);
+				s.step();
+			},
+			[&](size_t i, int a, std::string_view message) {
+				assert(rows[i] == a);
+				rejected.push_back(i);
+				messages.emplace_back(message);
+			}, 256);
+
+		assert((rejected == std::vector<size_t>{ 17, 500, 999 }));
+		for (const auto& message : messages) {
+			assert(message.find("constraint") != std::string::npos);
+		}
+		assert(stats.rows == 997 and stats.rejected == 3 and stats.batches == 4);
+		assert(stats.rollbacks > 3); // bisection
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT count(*) FROM t");
+		stmt.step();
+		assert(stmt.column_int(0) == 997);
+		assert(sqlite3_get_autocommit(db));
+
+		// OR ROLLBACK ends the transaction, so the row cannot be isolated
+		db.exec("DELETE FROM t");
+		rejected.clear();
+		bool thrown = false;
+		try {
+			sqlite::ingest_isolated(db, std::views::iota(0, 1000),
+				[&db](int a) {
+					auto s = db.cached("INSERT OR ROLLBACK INTO t VALUES (?)");
+					s.bind(1, a == 300 ? 3 : a);
+					s.step();
+				},
+				[&](size_t i, int, std::string_view) {
+					rejected.push_back(i);
+				}, 256);
+		}
+		catch (const sqlite::constraint& ex) {
+			thrown = ex.code() == SQLITE_CONSTRAINT_UNIQUE;
+		}
+		assert(thrown);
+		assert(rejected.empty());
+		stmt.reset();
+		stmt.step();
+		assert(stmt.column_int(0) == 256); // first batch
+		assert(sqlite3_get_autocommit(db));
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_exception()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT UNIQUE)");
+		db.exec("INSERT INTO t VALUES (1)");
+
+		try {
+			db.exec("INSERT INTO t VALUES (1)");
+			assert(false);
+		}
+		catch (const sqlite::constraint& ex) {
+			assert(ex.primary() == SQLITE_CONSTRAINT);
+			assert(ex.code() == SQLITE_CONSTRAINT_UNIQUE);
+			assert(std::string_view(ex.errmsg()).starts_with("UNIQUE constraint failed"));
+			const sqlite::exception copy(ex);
+			assert(copy.code() == ex.code());
+			assert(std::string_view(copy.what()) == ex.what());
+		}
+
+		try {
+			sqlite::stmt stmt(db);
+			stmt.prepare("SELECT a FRM t");
+			assert(false);
+		}
+		catch (const sqlite::exception& ex) {
+			assert(ex.code() == SQLITE_ERROR);
+			assert(ex.sql() == "SELECT a FRM t");
+			assert(ex.offset() > 0);
+			assert(std::string_view(ex.what()).find("near: SELECT a FRM t") != std::string_view::npos);
+		}
+
+		try {
+			sqlite::stmt stmt(db);
+			stmt.prepare("SELECT ?");
+			stmt.bind(2, 0);
+			assert(false);
+		}
+		catch (const std::runtime_error& ex) { // still a runtime_error
+			assert(dynamic_cast<const sqlite::exception*>(&ex)->primary() == SQLITE_RANGE);
+		}
+
+		try {
+			sqlite::stmt stmt(db);
+			stmt.prepare("SELECT ?");
+			stmt.bind_all(std::numeric_limits<uint64_t>::max());
+			assert(false);
+		}
+		catch (const sqlite::exception& ex) { // not the connection's last error
+			assert(ex.code() == SQLITE_MISMATCH);
+			assert(std::string_view(ex.errmsg()) == std::string("parameter 1: ") + sqlite3_errstr(SQLITE_MISMATCH));
+			assert(ex.sql() == "SELECT ?");
+		}
+
+		try {
+			sqlite::db none("no/such/dir/x.db", SQLITE_OPEN_READWRITE);
+			assert(false);
+		}
+		catch (const sqlite::exception& ex) {
+			assert(ex.primary() == SQLITE_CANTOPEN);
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	const char* file = "exception.db";
+	try {
+		{
+			sqlite::db a(file), b(file);
+			a.exec("PRAGMA journal_mode=WAL");
+			a.exec("CREATE TABLE t (x)");
+			b.exec("PRAGMA busy_timeout=0");
+			sqlite::transaction t(a, sqlite::transaction_mode::immediate);
+			try {
+				sqlite::transaction u(b, sqlite::transaction_mode::immediate);
+				assert(false);
+			}
+			catch (const sqlite::busy& ex) {
+				assert(ex.primary() == SQLITE_BUSY);
+			}
+			sqlite::stmt s(b);
+			s.prepare("INSERT INTO t VALUES (1)");
+			try {
+				sqlite::transact(s, sqlite::transaction_mode::immediate);
+				assert(false);
+			}
+			catch (const sqlite::busy& ex) {
+				assert(ex.code() == SQLITE_BUSY);
+				assert(std::string_view(ex.errmsg()) == "database is locked");
+			}
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	std::remove(file);
+	std::remove("exception.db-wal");
+	std::remove("exception.db-shm");
+
+	return 0;
+}
+
+int test_arrow_export()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d BOOLEAN, e DATETIME)");
+		db.exec("INSERT INTO t VALUES (1, 0.5, 'one', 1, 86400)");
+		db.exec("INSERT INTO t VALUES (2, NULL, NULL, 0, '1970-01-03')");
+		db.exec("INSERT INTO t VALUES (3, 1.5, 'three', 1, NULL)");
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b, c, d, e FROM t");
+		sqlite::arrow_export ex(stmt, 2);
+
+		ArrowSchema schema;
+		ex.schema(&schema);
+		assert(schema.n_children == 5);
+		assert(std::string_view(schema.format) == "+s");
+		assert(std::string_view(schema.children[0]->format) == "l");
+		assert(std::string_view(schema.children[1]->format) == "g");
+		assert(std::string_view(schema.children[2]->format) == "U");
+		assert(std::string_view(schema.children[3]->format) == "b");
+		assert(std::string_view(schema.children[4]->format) == "tss:UTC");
+		assert(std::string_view(schema.children[2]->name) == "c");
+		// move a child out, it outlives the parent
+		ArrowSchema child = *schema.children[2];
+		schema.children[2]->release = nullptr;
+		schema.release(&schema);
+		assert(!schema.release);
+		assert(std::string_view(child.name) == "c" and std::string_view(child.format) == "U");
+		child.release(&child);
+		assert(!child.release);
+
+		ArrowArray array;
+		assert(2 == ex.next(&array));
+		assert(array.length == 2 and array.n_children == 5);
+		{
+			const auto a = (const int64_t*)array.children[0]->buffers[1];
+			assert(a[0] == 1 and a[1] == 2);
+			assert(array.children[1]->null_count == 1);
+			const auto valid = (const uint8_t*)array.children[1]->buffers[0];
+			assert(valid[0] == 1);
+			const auto offset = (const int64_t*)array.children[2]->buffers[1];
+			const auto text = (const char*)array.children[2]->buffers[2];
+			assert(std::string_view(text + offset[0], offset[1] - offset[0]) == "one");
+			const auto d = (const uint8_t*)array.children[3]->buffers[1];
+			assert(d[0] == 1);
+			const auto e = (const int64_t*)array.children[4]->buffers[1];
+			assert(e[0] == 86400 and e[1] == 2 * 86400);
+		}
+		// consumer may move a child out before releasing the parent
+		ArrowArray c = *array.children[2];
+		array.children[2]->release = nullptr;
+		array.release(&array);
+		assert(!array.release);
+		c.release(&c);
+
+		assert(1 == ex.next(&array));
+		{
+			const auto a = (const int64_t*)array.children[0]->buffers[1];
+			assert(a[0] == 3);
+			assert(array.children[4]->null_count == 1);
+		}
+		array.release(&array);
+
+		assert(0 == ex.next(&array));
+		assert(!array.release);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	try {
+		// empty result uses declared types
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d BOOLEAN, e DATETIME)");
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b, c, d, e, NULL FROM t");
+		sqlite::arrow_export ex(stmt);
+		ArrowSchema schema;
+		ex.schema(&schema);
+		const char* formats[] = { "l", "g", "U", "b", "tss:UTC", "n" };
+		for (int j = 0; j < 6; ++j) {
+			assert(std::string_view(schema.children[j]->format) == formats[j]);
+		}
+		schema.release(&schema);
+		ArrowArray array;
+		assert(ex.next(&array) == 0 and !array.release);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+int test_arrow_import()
+{
+	try {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT, d BOOLEAN, e DATETIME, f BLOB)");
+		db.exec("INSERT INTO t VALUES (1, 0.5, 'one', 1, 86400, x'0102')");
+		db.exec("INSERT INTO t VALUES (2, NULL, NULL, 0, '1970-01-03', NULL)");
+		db.exec("INSERT INTO t VALUES (3, 1.5, 'three', 1, NULL, x'')");
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT a, b, c, d, e, f FROM t");
+		sqlite::arrow_export ex(stmt, 2);
+		ArrowSchema schema;
+		ex.schema(&schema);
+		sqlite::arrow_import im(db, "u", &schema);
+		schema.release(&schema);
+
+		ArrowArray array;
+		size_t rows = 0;
+		while (ex.next(&array)) {
+			rows += im(&array).rows;
+			assert(!array.release);
+		}
+		assert(rows == 3);
+
+		stmt.prepare("SELECT count(*) FROM t JOIN u USING (a) "
+			"WHERE t.b IS u.b AND t.c IS u.c AND t.d IS u.d AND t.f IS u.f");
+		stmt.step();
+		assert(stmt.column_int(0) == 3);
+		stmt.prepare("SELECT e FROM u ORDER BY a");
+		assert(stmt.step() == SQLITE_ROW and stmt.column_int64(0) == 86400);
+		assert(stmt.step() == SQLITE_ROW and stmt.column_int64(0) == 2 * 86400);
+		assert(stmt.step() == SQLITE_ROW and stmt.column_type(0) == SQLITE_NULL);
+		stmt.prepare("SELECT type FROM pragma_table_info('u') WHERE name = 'd'");
+		stmt.step();
+		assert(stmt.column_text_view(0) == "BOOLEAN");
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+	try {
+		// unsigned columns and names that must be quoted
+		sqlite::db db("");
+		const uint32_t u32[] = { 4'000'000'000u, 1 };
+		const uint64_t u64[] = { uint64_t(1) << 62, 2 };
+		const int64_t i64[] = { -1, 3 };
+		const char* formats[] = { "I", "L", "l" };
+		const char* names[] = { "order", "my col", "" };
+		const void* data[] = { u32, u64, i64 };
+
+		ArrowSchema fields[3];
+		ArrowSchema* field_ptr[3];
+		ArrowArray columns[3];
+		ArrowArray* column_ptr[3];
+		const void* buffers[3][2];
+		for (int j = 0; j < 3; ++j) {
+			fields[j] = ArrowSchema{ .format = formats[j], .name = names[j], .flags = ARROW_FLAG_NULLABLE };
+			field_ptr[j] = &fields[j];
+			buffers[j][0] = nullptr;
+			buffers[j][1] = data[j];
+			columns[j] = ArrowArray{ .length = 2, .n_buffers = 2, .buffers = buffers[j] };
+			column_ptr[j] = &columns[j];
+		}
+		const ArrowSchema schema{ .format = "+s", .name = "", .n_children = 3, .children = field_ptr };
+		static const void* no_buffers[1] = { nullptr };
+		ArrowArray array{ .length = 2, .n_buffers = 1, .n_children = 3, .buffers = no_buffers, .children = column_ptr,
+			.release = [](ArrowArray* a) { a->release = nullptr; } };
+
+		sqlite::arrow_import im(db, "u", &schema);
+		assert(im(&array).rows == 2);
+		assert(!array.release);
+
+		sqlite::stmt stmt(db);
+		stmt.prepare("SELECT [order], [my col], [] FROM u ORDER BY rowid");
+		assert(stmt.step() == SQLITE_ROW);
+		assert(stmt.column<uint32_t>(0) == u32[0] and stmt.column_int64(0) == 4'000'000'000);
+		assert(stmt.column<uint64_t>(1) == u64[0]);
+		assert(stmt.column_int64(2) == -1);
+		assert(stmt.step() == SQLITE_ROW and stmt.column_int64(0) == 1);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+#ifdef FMS_SQLITE_BENCH
+// Single-row versus multi-row VALUES inserts.
+int bench_multi_insert()
+{
+	try {
+		constexpr size_t n = 100'000;
+		std::vector<int64_t> a(n);
+		std::vector<double> b(n);
+		std::unique_ptr<bool[]> c(new bool[n]);
+		std::vector<datetime> d(n);
+		for (size_t i = 0; i < n; ++i) {
+			a[i] = i;
+			b[i] = i * 1.5;
+			c[i] = i % 3 == 0;
+			d[i] = datetime(time_t(i * 60));
+		}
+
+		for (size_t rows : { 1, 0 }) {
+			sqlite::db db("");
+			db.exec("CREATE TABLE t (a INT, b FLOAT, c BOOLEAN, d DATETIME)");
+			sqlite::bulk_insert<int64_t, double, bool, datetime> ins(db, "t", n);
+			ins.rows_per_insert(rows);
+			auto stats = ins(std::span(a), std::span(b), std::span(c.get(), n), std::span(d));
+			std::cout << "insert " << ins.rows_per_insert() << " rows per statement: "
+				<< static_cast<size_t>(stats.rows_per_second()) << " rows/sec\n";
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+
+// Lookaside use and prepare/step throughput with and without SQLITE_PREPARE_PERSISTENT.
+int bench_prepare_persistent()
+{
+	auto run = [](unsigned int flags) {
+		sqlite::db db("");
+		db.exec("CREATE TABLE t (a INT, b FLOAT, c TEXT)");
+		db.exec("INSERT INTO t VALUES (1, 1.5, 'a'), (2, 2.5, 'b')");
+
+		constexpr int n = 200, m = 100;
+		std::list<sqlite::stmt> stmts;
+		int cur, hi, miss, tmp;
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &tmp, &tmp, 1);
+
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < n; ++i) {
+			auto sql = std::string("SELECT a, b, c FROM t WHERE a > ") + std::to_string(i - n);
+			stmts.emplace_back(db).prepare(sql.c_str(), -1, flags);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &cur, &hi, 0);
+		sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &tmp, &miss, 0);
+		for (int j = 0; j < m; ++j) {
+			for (auto& stmt : stmts) {
+				while (SQLITE_ROW == stmt.step())
+					;
+				stmt.reset();
+			}
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		using us = std::chrono::microseconds;
+		std::cout << "prepare flags " << flags
+			<< ": lookaside used " << cur << " miss full " << miss
+			<< ", prepare " << std::chrono::duration_cast<us>(t1 - t0).count() / double(n) << "us/stmt"
+			<< ", step " << std::chrono::duration_cast<us>(t2 - t1).count() / double(n * m) << "us/query\n";
+	};
+
+	try {
+		run(0);
+		run(SQLITE_PREPARE_PERSISTENT);
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << '\n';
+	}
+
+	return 0;
+}
+#endif // FMS_SQLITE_BENCH
+
 int test_boolean()
 {
 	try {
@@ -340,9 +1974,37 @@ int main()
 		//stmt::test();
 #endif // _DEBUG
 		test_simple();
+		test_stmt_cache();
+		test_stmt_t();
+		test_bind_view();
+		test_bind_all();
+		test_bulk_insert();
+		test_names();
+		test_metadata();
+		test_row();
+		test_rows();
+		test_fetch_batch();
+		test_prefetch();
+		test_async();
+		test_pool();
+		test_writer();
+		test_durability();
+		test_pragma_profile();
+		test_bulk_load();
+		test_ingest();
+		test_transaction();
+		test_ingest_isolated();
+		test_exception();
+		test_arrow_export();
+		test_arrow_import();
 		test_boolean();
 		test_datetime();
 		//test_copy();
+
+#ifdef FMS_SQLITE_BENCH
+		bench_prepare_persistent();
+		bench_multi_insert();
+#endif // FMS_SQLITE_BENCH
 		//test_stmt_move();
 	}
 	catch (const std::exception& ex) {
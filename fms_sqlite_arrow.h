@@ -0,0 +1,494 @@
+// fms_sqlite_arrow.h - Arrow C Data Interface export
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#pragma once
+#include <chrono>
+#include "fms_sqlite_insert.h"
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	// Array type description
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowSchema*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+struct ArrowArray {
+	// Array data description
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowArray*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace sqlite {
+
+	// Arrow format string for a batch column storage type and declared extended type.
+	// BOOLEAN columns are bit-packed booleans, DATETIME columns are Unix time in seconds.
+	constexpr const char* arrow_format(int type, int extended_type = SQLITE_UNKNOWN)
+	{
+		if (extended_type == SQLITE_BOOLEAN) {
+			return "b";
+		}
+		if (extended_type == SQLITE_DATETIME) {
+			return "tss:UTC";
+		}
+
+		switch (type) {
+		case SQLITE_INTEGER:
+			return "l";
+		case SQLITE_FLOAT:
+			return "g";
+		case SQLITE_TEXT:
+			return "U"; // large utf8, int64 offsets
+		case SQLITE_BLOB:
+			return "Z"; // large binary, int64 offsets
+		}
+
+		return "n";
+	}
+#ifdef _DEBUG
+	static_assert(arrow_format(SQLITE_TEXT) == std::string_view("U"));
+	static_assert(arrow_format(SQLITE_FLOAT, SQLITE_DATETIME) == std::string_view("tss:UTC"));
+#endif // _DEBUG
+
+	// Export query results as Arrow record batches of struct arrays.
+	// Buffers are moved out of the fetched batch into the exported arrays,
+	// consumers own them until they call release.
+	class arrow_export {
+		stmt& s;
+		size_t n;
+		batch b;
+		size_t pending; // rows fetched but not yet exported
+		std::vector<int> extended; // declared extended type of each column
+
+		// Buffers of an exported column.
+		struct column_data {
+			batch::column c;
+			std::vector<uint8_t> bits; // SQLITE_BOOLEAN values
+			const void* buffers[3] = { nullptr, nullptr, nullptr };
+		};
+		// Children of an exported record batch.
+		struct batch_data {
+			std::vector<ArrowArray> arrays;
+			std::vector<ArrowArray*> children;
+		};
+		// Children of an exported schema. Each child owns its name.
+		struct schema_data {
+			std::vector<ArrowSchema> schemas;
+			std::vector<ArrowSchema*> children;
+		};
+
+		static void release_column(ArrowArray* a)
+		{
+			delete static_cast<column_data*>(a->private_data);
+			a->release = nullptr;
+		}
+		static void release_batch(ArrowArray* a)
+		{
+			auto* data = static_cast<batch_data*>(a->private_data);
+			for (auto& child : data->arrays) {
+				if (child.release) {
+					child.release(&child);
+				}
+			}
+			delete data;
+			a->release = nullptr;
+		}
+		static void release_field(ArrowSchema* s)
+		{
+			delete static_cast<std::string*>(s->private_data);
+			s->release = nullptr;
+		}
+		static void release_schema(ArrowSchema* s)
+		{
+			for (int64_t j = 0; j < s->n_children; ++j) {
+				if (s->children[j] and s->children[j]->release) {
+					s->children[j]->release(s->children[j]);
+				}
+			}
+			delete static_cast<schema_data*>(s->private_data);
+			s->release = nullptr;
+		}
+
+		void export_column(int j, ArrowArray* a)
+		{
+			auto* data = new column_data{ .c = std::move(b.cols[j]) };
+			auto& c = data->c;
+			b.cols[j].type = c.type; // keep storage type for the next fetch
+
+			*a = ArrowArray{
+				.length = static_cast<int64_t>(pending),
+				.null_count = static_cast<int64_t>(c.nulls),
+				.offset = 0,
+				.n_buffers = 2,
+				.n_children = 0,
+				.buffers = data->buffers,
+				.children = nullptr,
+				.dictionary = nullptr,
+				.release = release_column,
+				.private_data = data,
+			};
+			data->buffers[0] = c.nulls ? c.valid.data() : nullptr;
+
+			if (extended[j] == SQLITE_BOOLEAN) {
+				data->bits.assign((pending + 7) / 8, 0);
+				for (size_t i = 0; i < pending; ++i) {
+					if (c.integer[i]) {
+						data->bits[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+					}
+				}
+				data->buffers[1] = data->bits.data();
+			}
+			else if (c.type == SQLITE_INTEGER) {
+				data->buffers[1] = c.integer.data();
+			}
+			else if (c.type == SQLITE_FLOAT) {
+				data->buffers[1] = c.real.data();
+			}
+			else {
+				a->n_buffers = 3;
+				data->buffers[1] = c.offset.data();
+				data->buffers[2] = c.arena.data();
+			}
+		}
+
+	public:
+		// Fetch the first batch to fix column types.
+		arrow_export(stmt& s, size_t batch_size = 64 * 1024)
+			: s(s), n(batch_size), pending(s.fetch_batch(b, batch_size))
+		{
+			const int m = s.column_count();
+			extended.resize(m);
+			for (int j = 0; j < m; ++j) {
+				const auto& info = s.metadata(j);
+				extended[j] = info.extended_type;
+				// no rows, use the declared type so the schema matches non-empty results
+				auto& c = b.cols[j];
+				if (c.type == SQLITE_NULL) {
+					if (extended[j] == SQLITE_BOOLEAN or extended[j] == SQLITE_DATETIME) {
+						c.type = SQLITE_INTEGER;
+					}
+					else if (info.type == SQLITE_INTEGER or info.type == SQLITE_FLOAT or info.type == SQLITE_TEXT or info.type == SQLITE_BLOB) {
+						c.type = info.type;
+					}
+				}
+			}
+		}
+		arrow_export(const arrow_export&) = delete;
+		arrow_export& operator=(const arrow_export&) = delete;
+
+		// Struct schema with one nullable child per column.
+		void schema(ArrowSchema* out) const
+		{
+			const int m = s.column_count();
+			auto* data = new schema_data;
+			data->schemas.resize(m);
+			data->children.resize(m);
+			try {
+				// children can be moved out and released on their own
+				for (int j = 0; j < m; ++j) {
+					auto* name = new std::string(s.column_name(j));
+					data->schemas[j] = ArrowSchema{
+						.format = arrow_format(b.cols[j].type, extended[j]), // static
+						.name = name->c_str(),
+						.metadata = nullptr,
+						.flags = ARROW_FLAG_NULLABLE,
+						.n_children = 0,
+						.children = nullptr,
+						.dictionary = nullptr,
+						.release = release_field,
+						.private_data = name,
+					};
+					data->children[j] = &data->schemas[j];
+				}
+			}
+			catch (...) {
+				ArrowSchema a{ .n_children = m, .children = data->children.data(), .private_data = data };
+				release_schema(&a);
+				throw;
+			}
+
+			*out = ArrowSchema{
+				.format = "+s",
+				.name = "",
+				.metadata = nullptr,
+				.flags = 0,
+				.n_children = m,
+				.children = data->children.data(),
+				.dictionary = nullptr,
+				.release = release_schema,
+				.private_data = data,
+			};
+		}
+
+		// Export the next record batch into out. Returns number of rows, 0 when done.
+		size_t next(ArrowArray* out)
+		{
+			if (pending == 0) {
+				pending = s.fetch_batch(b, n);
+				if (pending == 0) {
+					out->release = nullptr;
+
+					return 0;
+				}
+			}
+
+			const int m = s.column_count();
+			auto* data = new batch_data;
+			data->arrays.resize(m);
+			data->children.resize(m);
+			try {
+				for (int j = 0; j < m; ++j) {
+					export_column(j, &data->arrays[j]);
+					data->children[j] = &data->arrays[j];
+				}
+			}
+			catch (...) {
+				ArrowArray a{ .private_data = data };
+				release_batch(&a);
+				throw;
+			}
+
+			static const void* no_buffers[1] = { nullptr };
+			*out = ArrowArray{
+				.length = static_cast<int64_t>(pending),
+				.null_count = 0,
+				.offset = 0,
+				.n_buffers = 1,
+				.n_children = m,
+				.buffers = no_buffers,
+				.children = data->children.data(),
+				.dictionary = nullptr,
+				.release = release_batch,
+				.private_data = data,
+			};
+
+			const size_t rows = pending;
+			pending = 0;
+
+			return rows;
+		}
+	};
+
+	// Import Arrow record batches of struct arrays into a table.
+	// Values are bound from the Arrow buffers through one reused INSERT statement,
+	// text and blobs in place with SQLITE_STATIC.
+	class arrow_import {
+		// How to read and bind an Arrow child array.
+		struct field {
+			std::string name;
+			const char* decl;  // declared SQLite type
+			char physical;     // Arrow primitive format character
+			int64_t mul = 1;   // Unix time = value * mul / div
+			int64_t div = 1;
+		};
+		sqlite3* pdb;
+		std::string table;
+		std::vector<field> fields;
+		stmt insert;
+
+		// Map an Arrow format string to a field. Throws if unsupported.
+		static field make_field(const ArrowSchema* schema)
+		{
+			const std::string_view format(schema->format);
+			field f{ .name = schema->name ? schema->name : "", .decl = nullptr, .physical = format.empty() ? '\0' : format[0] };
+			if (format.size() == 1) {
+				switch (f.physical) {
+				case 'c': case 'C': case 's': case 'S': case 'i': case 'I': case 'l': case 'L':
+					f.decl = "INTEGER";
+					break;
+				case 'f': case 'g':
+					f.decl = "FLOAT";
+					break;
+				case 'u': case 'U':
+					f.decl = "TEXT";
+					break;
+				case 'z': case 'Z':
+					f.decl = "BLOB";
+					break;
+				case 'b':
+					f.decl = "BOOLEAN";
+					break;
+				}
+			}
+			else if (format == "tdD") { // int32 days
+				f = field{ .name = f.name, .decl = "DATETIME", .physical = 'i', .mul = 24 * 60 * 60 };
+			}
+			else if (format == "tdm") { // int64 milliseconds
+				f = field{ .name = f.name, .decl = "DATETIME", .physical = 'l', .div = 1'000 };
+			}
+			else if (format.starts_with("ts") and format.size() >= 4 and format[3] == ':') {
+				f = field{ .name = f.name, .decl = "DATETIME", .physical = 'l' };
+				switch (format[2]) {
+				case 's': break;
+				case 'm': f.div = 1'000; break;
+				case 'u': f.div = 1'000'000; break;
+				case 'n': f.div = 1'000'000'000; break;
+				default: f.decl = nullptr;
+				}
+			}
+			if (!f.decl) {
+				throw std::runtime_error(fms::error("sqlite::arrow_import: unsupported format").at(format).what());
+			}
+
+			return f;
+		}
+
+		static bool is_valid(const ArrowArray* a, int64_t i)
+		{
+			const auto valid = static_cast<const uint8_t*>(a->buffers[0]);
+			return a->null_count == 0 or !valid or (valid[i / 8] & (1u << (i % 8)));
+		}
+		template<class T>
+		static T value(const ArrowArray* a, int64_t i)
+		{
+			return static_cast<const T*>(a->buffers[1])[i];
+		}
+		template<class O>
+		static std::string_view bytes(const ArrowArray* a, int64_t i)
+		{
+			const auto offset = static_cast<const O*>(a->buffers[1]);
+			const auto data = static_cast<const char*>(a->buffers[2]);
+
+			return std::string_view(data + offset[i], static_cast<size_t>(offset[i + 1] - offset[i]));
+		}
+
+		// Bind row i of child a to parameter k.
+		int bind(int k, const field& f, const ArrowArray* a, int64_t i) noexcept
+		{
+			i += a->offset;
+			if (!is_valid(a, i)) {
+				return insert.bind_typed(k, nullptr);
+			}
+
+			switch (f.physical) {
+			case 'c': return insert.bind_typed(k, value<int8_t>(a, i));
+			case 'C': return insert.bind_typed(k, value<uint8_t>(a, i));
+			case 's': return insert.bind_typed(k, value<int16_t>(a, i));
+			case 'S': return insert.bind_typed(k, value<uint16_t>(a, i));
+			case 'i': return insert.bind_typed(k, value<int32_t>(a, i) * f.mul);
+			case 'I': return insert.bind_typed(k, value<uint32_t>(a, i));
+			case 'l': return insert.bind_typed(k, value<int64_t>(a, i) * f.mul / f.div);
+			case 'L': return insert.bind_typed(k, value<uint64_t>(a, i));
+			case 'f': return insert.bind_typed(k, value<float>(a, i));
+			case 'g': return insert.bind_typed(k, value<double>(a, i));
+			case 'b': {
+				const auto bits = static_cast<const uint8_t*>(a->buffers[1]);
+				return insert.bind_typed(k, (bits[i / 8] & (1u << (i % 8))) != 0);
+			}
+			case 'u': return insert.bind_typed(k, bytes<int32_t>(a, i), SQLITE_STATIC);
+			case 'U': return insert.bind_typed(k, bytes<int64_t>(a, i), SQLITE_STATIC);
+			case 'z': {
+				const auto b = bytes<int32_t>(a, i);
+				return sqlite3_bind_blob64(insert, k, b.data(), b.size(), SQLITE_STATIC);
+			}
+			case 'Z': {
+				const auto b = bytes<int64_t>(a, i);
+				return sqlite3_bind_blob64(insert, k, b.data(), b.size(), SQLITE_STATIC);
+			}
+			}
+
+			return SQLITE_MISMATCH;
+		}
+
+	public:
+		// Create table from the schema if it does not exist and prepare the INSERT.
+		arrow_import(sqlite3* pdb, const std::string_view& table, const ArrowSchema* schema)
+			: pdb(pdb), table(table), insert(pdb)
+		{
+			if (std::string_view(schema->format) != "+s") {
+				throw std::runtime_error(fms::error("sqlite::arrow_import: schema must be a struct").at(schema->format).what());
+			}
+
+			std::vector<std::string_view> names;
+			std::string sql("CREATE TABLE IF NOT EXISTS ");
+			sql.append(table_name(table)).append(" (");
+			for (int64_t j = 0; j < schema->n_children; ++j) {
+				fields.push_back(make_field(schema->children[j]));
+				sql.append(j ? ", " : "").append(table_name(fields.back().name)).append(" ").append(fields.back().decl);
+			}
+			sql.append(")");
+			FMS_SQLITE_ERRMSG(pdb, sqlite3_exec(pdb, sql.c_str(), 0, 0, 0));
+
+			for (const auto& f : fields) {
+				names.push_back(f.name);
+			}
+			insert.prepare(insert_sql(table, fields.size(), names), SQLITE_PREPARE_PERSISTENT);
+		}
+		arrow_import(const arrow_import&) = delete;
+		arrow_import& operator=(const arrow_import&) = delete;
+
+		// Insert the rows of a record batch in one transaction and release it.
+		insert_stats operator()(ArrowArray* array)
+		{
+			struct release_guard {
+				ArrowArray* a;
+				~release_guard()
+				{
+					if (a->release) {
+						a->release(a);
+					}
+				}
+			} guard{ array };
+
+			if (array->n_children != static_cast<int64_t>(fields.size())) {
+				throw std::runtime_error(fms::error("sqlite::arrow_import: wrong number of columns").at(table).what());
+			}
+
+			insert_stats stats;
+			const auto t0 = std::chrono::steady_clock::now();
+			try {
+				transact(pdb, [this, array]() {
+					const int m = static_cast<int>(fields.size());
+					for (int64_t i = 0; i < array->length; ++i) {
+						int rc = SQLITE_OK;
+						for (int j = 0; rc == SQLITE_OK and j < m; ++j) {
+							rc = bind(j + 1, fields[j], array->children[j], array->offset + i);
+						}
+						FMS_SQLITE_ERRMSG(pdb, rc);
+						insert.step();
+						insert.reset();
+					}
+				});
+			}
+			catch (...) {
+				insert.reset();
+				insert.clear_bindings();
+				throw;
+			}
+			insert.clear_bindings();
+			stats.rows = static_cast<size_t>(array->length);
+			stats.batches = 1;
+			stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+			return stats;
+		}
+	};
+
+} // namespace sqlite
@@ -0,0 +1,142 @@
+// fms_sqlite_async.h - coroutine awaitables for blocking SQLite calls
+#pragma once
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Run blocking calls for one connection on a dedicated thread, in order.
+	// Awaiting coroutines are resumed by resume(h), or on the executor thread if not set.
+	// Calls on the connection must only be made through the executor while it runs.
+	// sqlite::executor ex(db, [&loop](auto h) { loop.post(h); });
+	// int ret = co_await ex.async_step(stmt);
+	class executor {
+		db& d;
+		std::function<void(std::coroutine_handle<>)> resume;
+		std::mutex m;
+		std::condition_variable cv;
+		std::deque<std::function<void()>> jobs;
+		bool stop = false;
+		std::thread worker;
+
+		void run()
+		{
+			for (;;) {
+				std::unique_lock lock(m);
+				cv.wait(lock, [this] { return stop or !jobs.empty(); });
+				if (jobs.empty()) {
+					return; // stop after draining
+				}
+				auto job = std::move(jobs.front());
+				jobs.pop_front();
+				lock.unlock();
+				job();
+			}
+		}
+	public:
+		// Awaitable result of f() run on the executor.
+		template<class F>
+		class awaitable {
+			using R = std::invoke_result_t<F>;
+			// void results are stored as bool
+			using V = std::conditional_t<std::is_void_v<R>, bool, R>;
+
+			executor& ex;
+			F f;
+			std::optional<V> value;
+			std::exception_ptr error;
+		public:
+			awaitable(executor& ex, F f)
+				: ex{ ex }, f{ std::move(f) }
+			{ }
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				ex.post([this, h]() {
+					try {
+						if constexpr (std::is_void_v<R>) {
+							f();
+							value.emplace(true);
+						}
+						else {
+							value.emplace(f());
+						}
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+					if (ex.resume) {
+						ex.resume(h);
+					}
+					else {
+						h.resume();
+					}
+				});
+			}
+			R await_resume()
+			{
+				if (error) {
+					std::rethrow_exception(error);
+				}
+				if constexpr (!std::is_void_v<R>) {
+					return std::move(*value);
+				}
+			}
+		};
+
+		explicit executor(db& d, std::function<void(std::coroutine_handle<>)> resume = {})
+			: d{ d }, resume{ std::move(resume) }, worker(&executor::run, this)
+		{ }
+		executor(const executor&) = delete;
+		executor& operator=(const executor&) = delete;
+		// Finish queued calls and join.
+		~executor()
+		{
+			{
+				std::lock_guard lock(m);
+				stop = true;
+			}
+			cv.notify_one();
+			worker.join();
+		}
+
+		// Queue job to run on the executor thread.
+		void post(std::function<void()> job)
+		{
+			{
+				std::lock_guard lock(m);
+				jobs.push_back(std::move(job));
+			}
+			cv.notify_one();
+		}
+
+		// co_await ex.async(f) runs f() on the executor and returns its result.
+		template<class F>
+		awaitable<F> async(F f)
+		{
+			return awaitable<F>(*this, std::move(f));
+		}
+		// co_await ex.async_step(stmt) returns SQLITE_ROW or SQLITE_DONE.
+		auto async_step(stmt& s)
+		{
+			return async([&s]() { return s.step(); });
+		}
+		// co_await ex.async_exec(sql) runs db::exec on the executor.
+		auto async_exec(std::string sql)
+		{
+			return async([this, sql = std::move(sql)]() { return d.exec(sql.c_str()); });
+		}
+	};
+
+} // namespace sqlite
@@ -0,0 +1,190 @@
+// fms_sqlite_durable.h - durability tickets for WAL commits
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Track when WAL commits reach disk.
+	// With synchronous=NORMAL, commits are not synced. A checkpoint syncs the WAL and
+	// the database file, so every commit made before it is durable. A syncer thread
+	// runs a checkpoint every interval, sooner if someone is waiting.
+	// The connection must be in WAL mode and opened without SQLITE_OPEN_NOMUTEX.
+	// Installing the wal_hook replaces automatic checkpoints until this is destroyed.
+	// sqlite::durability d(db);
+	// auto t = d.commit([&] { db.exec("INSERT ..."); });
+	// t.wait_durable();
+	class durability {
+		sqlite3* pdb;
+		std::mutex m;
+		std::condition_variable cv;
+		uint64_t committed = 0; // commits seen by the wal_hook
+		uint64_t durable = 0;   // commits covered by a checkpoint
+		size_t waiting = 0;     // threads blocked in wait_durable
+		bool urgent = false;    // WAL reached the automatic checkpoint size
+		size_t checkpoints = 0;
+		int autocheckpoint;     // wal_autocheckpoint pages before the hook was installed
+		bool stop = false;
+		std::chrono::milliseconds interval;
+		std::thread syncer;
+
+		// Sequence number of the last commit made by this thread, set by wal_hook.
+		struct hooked {
+			const durability* d;
+			uint64_t seq;
+		};
+		static inline thread_local hooked last_hooked{ nullptr, 0 };
+
+		// Called on the committing thread after each COMMIT.
+		// https://sqlite.org/c3ref/wal_hook.html
+		static int wal_hook(void* data, sqlite3*, const char*, int pages)
+		{
+			auto* d = static_cast<durability*>(data);
+			{
+				std::lock_guard lock(d->m);
+				last_hooked = { d, ++d->committed };
+				d->urgent = d->urgent or (d->autocheckpoint > 0 and pages >= d->autocheckpoint);
+			}
+			d->cv.notify_all();
+
+			return SQLITE_OK;
+		}
+		// Checkpoint and mark commits before it durable. Must not hold m.
+		bool checkpoint(uint64_t seq)
+		{
+			int log = 0, ckpt = 0;
+			const int rc = sqlite3_wal_checkpoint_v2(pdb, nullptr, SQLITE_CHECKPOINT_FULL, &log, &ckpt);
+			if (rc != SQLITE_OK or log != ckpt) {
+				return false; // busy or locked, try again later
+			}
+			{
+				std::lock_guard lock(m);
+				durable = std::max(durable, seq);
+				++checkpoints;
+			}
+			cv.notify_all();
+
+			return true;
+		}
+		void run()
+		{
+			std::unique_lock lock(m);
+			while (!stop) {
+				cv.wait_for(lock, interval, [this] { return stop or (committed > durable and (waiting > 0 or urgent)); });
+				if (committed > durable) {
+					const uint64_t seq = committed;
+					urgent = false;
+					lock.unlock();
+					if (!checkpoint(seq) and !stop) {
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+					lock.lock();
+				}
+			}
+		}
+	public:
+		// A commit that can be waited on until it is on disk.
+		class ticket {
+			durability* d;
+			uint64_t seq;
+		public:
+			ticket(durability& d, uint64_t seq) noexcept
+				: d{ &d }, seq{ seq }
+			{ }
+
+			uint64_t sequence() const noexcept
+			{
+				return seq;
+			}
+			bool is_durable() const
+			{
+				std::lock_guard lock(d->m);
+
+				return d->durable >= seq;
+			}
+			// Block until a checkpoint covers this commit.
+			void wait_durable() const
+			{
+				std::unique_lock lock(d->m);
+				if (d->durable >= seq) {
+					return;
+				}
+				++d->waiting;
+				d->cv.notify_all();
+				d->cv.wait(lock, [this] { return d->durable >= seq; });
+				--d->waiting;
+			}
+		};
+
+		durability(sqlite3* pdb, std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+			: pdb{ pdb }, interval{ interval }
+		{
+			sqlite::stmt s(pdb);
+			s.prepare("PRAGMA journal_mode");
+			if (s.step() != SQLITE_ROW or s.column_text_view(0) != "wal") {
+				throw std::runtime_error(fms::error("sqlite::durability: database must be in WAL mode").what());
+			}
+			s.prepare("PRAGMA wal_autocheckpoint");
+			s.step();
+			autocheckpoint = s.column_int(0);
+			s.reset();
+			sqlite3_wal_hook(pdb, wal_hook, this);
+			syncer = std::thread(&durability::run, this);
+		}
+		durability(const durability&) = delete;
+		durability& operator=(const durability&) = delete;
+		// Sync outstanding commits and restore the previous automatic checkpoint size.
+		~durability()
+		{
+			{
+				std::lock_guard lock(m);
+				stop = true;
+			}
+			cv.notify_all();
+			syncer.join();
+			checkpoint(commits());
+			sqlite3_wal_autocheckpoint(pdb, autocheckpoint);
+		}
+
+		// Ticket for the most recent commit on the connection.
+		ticket last()
+		{
+			std::lock_guard lock(m);
+
+			return ticket(*this, committed);
+		}
+		// Run f() as a transaction and return a ticket for its COMMIT.
+		// If f() wrote nothing there is no WAL commit and the ticket is already durable.
+		template<class F>
+		ticket commit(F&& f, transaction_mode mode = transaction_mode::deferred)
+		{
+			last_hooked = { nullptr, 0 };
+			transact(pdb, std::forward<F>(f), mode);
+
+			return ticket(*this, last_hooked.d == this ? last_hooked.seq : 0);
+		}
+		// Make all commits so far durable.
+		void sync()
+		{
+			last().wait_durable();
+		}
+
+		uint64_t commits()
+		{
+			std::lock_guard lock(m);
+
+			return committed;
+		}
+		size_t syncs()
+		{
+			std::lock_guard lock(m);
+
+			return checkpoints;
+		}
+	};
+
+} // namespace sqlite
@@ -0,0 +1,371 @@
+// fms_sqlite_insert.h - bulk insert
+#pragma once
+#include <chrono>
+#include <map>
+#include <span>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Rows inserted and elapsed time.
+	struct insert_stats {
+		size_t rows = 0;
+		size_t batches = 0;
+		double seconds = 0;
+
+		double rows_per_second() const
+		{
+			return seconds > 0 ? rows / seconds : 0;
+		}
+	};
+
+	// INSERT INTO [table] [([name], ...)] VALUES (?, ..., ?)[, (?, ..., ?)...]
+	template<std::ranges::forward_range N = std::span<const std::string_view>>
+	inline std::string insert_sql(const std::string_view& table, size_t n,
+		const N& names = {}, size_t rows = 1)
+	{
+		std::string sql("INSERT INTO ");
+		sql.append(table_name(table));
+		if (!std::ranges::empty(names)) {
+			sql.append(" (");
+			const char* sep = "";
+			for (const auto& name : names) {
+				sql.append(sep).append(table_name(std::string_view(name)));
+				sep = ", ";
+			}
+			sql.append(")");
+		}
+		sql.append(" VALUES ");
+		for (size_t i = 0; i < rows; ++i) {
+			sql.append(i ? ", (" : "(");
+			for (size_t j = 0; j < n; ++j) {
+				sql.append(j ? ", ?" : "?");
+			}
+			sql.append(")");
+		}
+
+		return sql;
+	}
+
+	// Insert columns of contiguous values into a table.
+	// Rows are committed in batches of batch_size rows.
+	// Each INSERT statement binds rows_per_insert rows using a multi-row VALUES clause,
+	// by default as many as SQLITE_LIMIT_VARIABLE_NUMBER allows. Use rows_per_insert(1) for single rows.
+	// Text is bound with SQLITE_STATIC so columns must outlive operator().
+	// bulk_insert<int64_t, double> ins(db, "t");
+	// ins(std::span(a), std::span(b));
+	template<class... T>
+	class bulk_insert {
+		static constexpr size_t max_rows_per_insert = 512; // keep VDBE programs small
+		sqlite3* pdb;
+		std::string table;
+		std::vector<std::string> names; // copied, caller's names may not outlive this
+		size_t batch;
+		size_t rows; // rows per INSERT
+		std::map<size_t, stmt> stmts; // rows -> INSERT statement
+
+		// Prepared INSERT for r rows.
+		stmt& insert(size_t r)
+		{
+			auto [i, inserted] = stmts.try_emplace(r, pdb);
+			if (inserted) {
+				try {
+					i->second.prepare(insert_sql(table, sizeof...(T), names, r), SQLITE_PREPARE_PERSISTENT);
+				}
+				catch (...) {
+					stmts.erase(i);
+					throw;
+				}
+			}
+
+			return i->second;
+		}
+		void reset() noexcept
+		{
+			for (auto& [r, s] : stmts) {
+				s.reset();
+				s.clear_bindings();
+			}
+		}
+	public:
+		bulk_insert(sqlite3* pdb, const std::string_view& table, size_t batch_size = 10'000,
+			std::span<const std::string_view> names = {})
+			: pdb(pdb), table(table), names(names.begin(), names.end()), batch(batch_size ? batch_size : 1), rows(1)
+		{
+			if (!names.empty() and names.size() != sizeof...(T)) {
+				throw std::runtime_error(fms::error("sqlite::bulk_insert: wrong number of column names").at(table).what());
+			}
+			rows_per_insert(0);
+			insert(rows);
+		}
+		bulk_insert(const bulk_insert&) = delete;
+		bulk_insert& operator=(const bulk_insert&) = delete;
+		~bulk_insert() = default;
+
+		size_t batch_size() const
+		{
+			return batch;
+		}
+		bulk_insert& batch_size(size_t n)
+		{
+			batch = n ? n : 1;
+
+			return *this;
+		}
+
+		size_t rows_per_insert() const
+		{
+			return rows;
+		}
+		// Use 0 to pick the largest number of rows SQLITE_LIMIT_VARIABLE_NUMBER allows.
+		bulk_insert& rows_per_insert(size_t n)
+		{
+			if (n == 0) {
+				const size_t vars = sqlite3_limit(pdb, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+				n = std::min(vars / std::max(sizeof...(T), size_t(1)), max_rows_per_insert);
+			}
+			rows = n ? n : 1;
+
+			return *this;
+		}
+
+		// Insert all rows. Columns must have the same size.
+		insert_stats operator()(std::span<const T>... cols)
+		{
+			const size_t n = std::get<0>(std::tie(cols...)).size();
+			if (((cols.size() != n) or ...)) {
+				throw std::runtime_error(fms::error("sqlite::bulk_insert: columns have different sizes").what());
+			}
+
+			insert_stats stats;
+			const auto t0 = std::chrono::steady_clock::now();
+			try {
+				for (size_t i = 0; i < n; i += batch) {
+					const size_t e = std::min(n, i + batch);
+					transact(pdb, [this, i, e, &cols...]() {
+						for (size_t k = i; k < e; k += rows) {
+							const size_t r = std::min(rows, e - k);
+							stmt& s = insert(r);
+							int j = 0;
+							int rc = SQLITE_OK;
+							for (size_t row = k; row < k + r; ++row) {
+								((rc = (rc == SQLITE_OK ? s.bind_typed(++j, cols[row], SQLITE_STATIC) : rc)), ...);
+							}
+							if (rc != SQLITE_OK) {
+								throw_error(rc, pdb);
+							}
+							s.step();
+							s.reset();
+						}
+					});
+					stats.rows = e;
+					++stats.batches;
+				}
+			}
+			catch (...) {
+				reset();
+				throw;
+			}
+			reset();
+			stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+			return stats;
+		}
+	};
+
+	// Ingest counters.
+	struct ingest_stats : insert_stats {
+		size_t batch_size = 0;            // rows per transaction for the next batch
+		double last_commit_seconds = 0;   // duration of the last transaction
+		size_t last_wal_pages = 0;        // pages written by the last transaction
+		size_t wal_pages = 0;             // pages written by all transactions
+	};
+
+	// Run rows in transactions, adjusting rows per transaction toward a target latency.
+	// Each batch is scaled by target / latency, at most halving or doubling it,
+	// and shrunk further if it writes more than max_wal_pages.
+	// sqlite::ingest in(db, std::chrono::milliseconds(50));
+	// in(rows, [&](const auto& row) { stmt.bind_all(row); stmt.step(); stmt.reset(); });
+	class ingest {
+		sqlite3* pdb;
+		double target;
+		size_t batch, min_batch, max_batch;
+		size_t max_pages;
+		ingest_stats counters;
+
+		// Pages written by the connection so far. In WAL mode these are WAL frames.
+		// https://sqlite.org/c3ref/c_dbstatus_options.html
+		size_t pages_written() const
+		{
+			int cur = 0, hi = 0;
+			sqlite3_db_status(pdb, SQLITE_DBSTATUS_CACHE_WRITE, &cur, &hi, 0);
+
+			return static_cast<size_t>(cur);
+		}
+		void update(size_t n, double seconds, size_t pages)
+		{
+			double next = static_cast<double>(batch);
+			if (n and seconds > 0) {
+				next = std::clamp(n * target / seconds, batch / 2., batch * 2.);
+			}
+			if (max_pages and pages > max_pages) {
+				next = std::min(next, static_cast<double>(n) * max_pages / pages);
+			}
+			batch = std::clamp(static_cast<size_t>(next), min_batch, max_batch);
+
+			counters.rows += n;
+			++counters.batches;
+			counters.seconds += seconds;
+			counters.batch_size = batch;
+			counters.last_commit_seconds = seconds;
+			counters.last_wal_pages = pages;
+			counters.wal_pages += pages;
+		}
+	public:
+		ingest(sqlite3* pdb, std::chrono::duration<double> target_latency = std::chrono::milliseconds(50),
+			size_t initial_batch = 1'000)
+			: pdb(pdb), target(target_latency.count()), batch(initial_batch ? initial_batch : 1),
+			min_batch(1), max_batch(1'000'000), max_pages(0)
+		{
+			counters.batch_size = batch;
+		}
+
+		size_t batch_size() const
+		{
+			return batch;
+		}
+		// Bounds on rows per transaction.
+		ingest& limits(size_t min_rows, size_t max_rows)
+		{
+			min_batch = std::max(min_rows, size_t(1));
+			max_batch = std::max(max_rows, min_batch);
+			batch = std::clamp(batch, min_batch, max_batch);
+
+			return *this;
+		}
+		// Most pages a transaction should add to the WAL, 0 for no limit.
+		ingest& max_wal_pages(size_t pages)
+		{
+			max_pages = pages;
+
+			return *this;
+		}
+
+		// Call f(row) for each row of r, batch_size() rows per transaction.
+		template<std::ranges::input_range R, class F>
+		const ingest_stats& operator()(R&& r, F&& f)
+		{
+			auto i = std::ranges::begin(r);
+			const auto e = std::ranges::end(r);
+			while (i != e) {
+				const size_t b = batch;
+				size_t n = 0;
+				const size_t p0 = pages_written();
+				const auto t0 = std::chrono::steady_clock::now();
+				transact(pdb, [&]() {
+					for (; n < b and i != e; ++i, ++n) {
+						f(*i);
+					}
+				});
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+				update(n, seconds, pages_written() - p0);
+			}
+
+			return counters;
+		}
+
+		const ingest_stats& stats() const
+		{
+			return counters;
+		}
+	};
+
+	// Counters for ingest_isolated.
+	struct isolate_stats : insert_stats {
+		size_t rejected = 0;  // rows sent to the reject sink
+		size_t rollbacks = 0; // savepoints rolled back while isolating them
+	};
+
+	// Call f(row) for each row of r, batch_size rows per transaction, each batch in a savepoint.
+	// If a batch throws it is rolled back and bisected with nested savepoints until the
+	// failing rows are isolated. Those are passed to reject(index, row, message) and the
+	// rest are committed. f must leave its statements usable after throwing, e.g. use db::cached.
+	// Bisection runs f again on rows that succeeded before a rollback, so f may be called
+	// several times for the same row and must not have side effects outside the database.
+	// Errors not caused by a row (busy, corrupt, full, I/O, out of memory, interrupt) are
+	// rethrown, as are errors that ended the transaction, e.g. from INSERT OR ROLLBACK.
+	template<std::ranges::random_access_range R, class F, class S>
+	inline isolate_stats ingest_isolated(db& d, R&& r, F&& f, S&& reject, size_t batch_size = 10'000)
+	{
+		isolate_stats stats;
+		const auto t0 = std::chrono::steady_clock::now();
+		const size_t n = std::ranges::size(r);
+		auto row = [&r](size_t i) -> decltype(auto) { return std::ranges::begin(r)[i]; };
+		// Bisecting cannot isolate the row that caused ex.
+		auto fatal = [&d](const std::exception& ex) {
+			if (sqlite3_get_autocommit(d)) {
+				return true; // SQLite rolled back the batch
+			}
+			if (const auto* e = dynamic_cast<const exception*>(&ex)) {
+				switch (e->primary()) {
+				case SQLITE_BUSY:
+				case SQLITE_CORRUPT:
+				case SQLITE_NOTADB:
+				case SQLITE_FULL:
+				case SQLITE_IOERR:
+				case SQLITE_NOMEM:
+				case SQLITE_INTERRUPT:
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		// Run rows [b, e) in a savepoint, bisecting on failure.
+		auto run = [&](auto& self, size_t b, size_t e) -> void {
+			{
+				transaction sp(d);
+				try {
+					for (size_t i = b; i < e; ++i) {
+						f(row(i));
+					}
+					sp.commit();
+
+					return;
+				}
+				catch (const std::exception& ex) {
+					if (fatal(ex)) {
+						throw;
+					}
+					++stats.rollbacks;
+					if (e - b == 1) {
+						sp.rollback();
+						++stats.rejected;
+						reject(b, row(b), std::string_view(ex.what()));
+
+						return;
+					}
+				}
+			}
+			const size_t m = b + (e - b) / 2;
+			self(self, b, m);
+			self(self, m, e);
+		};
+
+		batch_size = batch_size ? batch_size : 1;
+		for (size_t b = 0; b < n; b += batch_size) {
+			const size_t e = std::min(n, b + batch_size);
+			transaction t(d);
+			run(run, b, e);
+			t.commit();
+			stats.rows += e - b;
+			++stats.batches;
+		}
+		stats.rows -= stats.rejected;
+		stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		return stats;
+	}
+
+} // namespace sqlite
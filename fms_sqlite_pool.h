@@ -0,0 +1,160 @@
+// fms_sqlite_pool.h - WAL connection pool
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Checkout counters.
+	struct pool_stats {
+		size_t checkouts = 0;
+		size_t waits = 0;        // checkouts that had to wait for a connection
+		double wait_seconds = 0; // total time spent waiting
+		size_t affinity = 0;     // reader checkouts that got the thread's previous connection
+	};
+
+	// One writer and N read-only connections to a WAL database file.
+	// Connections are opened with SQLITE_OPEN_NOMUTEX and must be used by one thread at a time.
+	// Each connection has its own statement cache.
+	// sqlite::pool p("a.db", 4);
+	// { auto r = p.reader(); r->exec("SELECT ..."); }
+	// { auto w = p.writer(); w->exec("INSERT ..."); }
+	class pool {
+		std::unique_ptr<db> w;
+		std::vector<std::unique_ptr<db>> readers;
+		std::vector<db*> idle;  // idle readers
+		bool writing = false;   // writer is checked out
+		std::unordered_map<std::thread::id, db*> last; // reader last used by each thread
+		pool_stats counters;
+		std::mutex m;
+		std::condition_variable cv;
+
+		// Wait for ready() under the lock and count checkouts.
+		template<class F>
+		void checkout(std::unique_lock<std::mutex>& lock, F&& ready)
+		{
+			++counters.checkouts;
+			if (!ready()) {
+				++counters.waits;
+				const auto t0 = std::chrono::steady_clock::now();
+				cv.wait(lock, ready);
+				counters.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			}
+		}
+		void checkin(db* d)
+		{
+			{
+				std::lock_guard lock(m);
+				if (d == w.get()) {
+					writing = false;
+				}
+				else {
+					idle.push_back(d);
+				}
+			}
+			cv.notify_all();
+		}
+	public:
+		// Connection checked out of a pool, returned when it goes out of scope.
+		class lease {
+			pool* p;
+			db* d;
+		public:
+			lease(pool& p, db* d) noexcept
+				: p{ &p }, d{ d }
+			{ }
+			lease(const lease&) = delete;
+			lease& operator=(const lease&) = delete;
+			lease(lease&& l) noexcept
+				: p{ l.p }, d{ std::exchange(l.d, nullptr) }
+			{ }
+			lease& operator=(lease&&) = delete;
+			~lease()
+			{
+				if (d) {
+					p->checkin(d);
+				}
+			}
+
+			db& operator*() const noexcept
+			{
+				return *d;
+			}
+			db* operator->() const noexcept
+			{
+				return d;
+			}
+			operator sqlite3* () const noexcept
+			{
+				return *d;
+			}
+		};
+
+		// The writer sets the default pragmas, readers are read-only with query_only on.
+		pool(const char* filename, size_t nreaders = 4)
+		{
+			if (!filename or !*filename) {
+				throw std::runtime_error(fms::error("sqlite::pool: requires a database file").what());
+			}
+			w = std::make_unique<db>(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX);
+			w->default_pragmas();
+			for (size_t i = 0; i < std::max(nreaders, size_t(1)); ++i) {
+				auto& r = readers.emplace_back(std::make_unique<db>(filename, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX));
+				r->pragma("busy_timeout", 5000);
+				r->pragma("query_only", "ON");
+				idle.push_back(r.get());
+			}
+		}
+		pool(const pool&) = delete;
+		pool& operator=(const pool&) = delete;
+		// Leases must not outlive the pool.
+		~pool() = default;
+
+		size_t size() const
+		{
+			return readers.size();
+		}
+
+		// Read-only connection, preferring the one this thread used last.
+		lease reader()
+		{
+			std::unique_lock lock(m);
+			checkout(lock, [this] { return !idle.empty(); });
+
+			auto i = std::prev(idle.end());
+			auto l = last.find(std::this_thread::get_id());
+			if (l != last.end()) {
+				if (auto j = std::find(idle.begin(), idle.end(), l->second); j != idle.end()) {
+					i = j;
+					++counters.affinity;
+				}
+			}
+			db* d = *i;
+			idle.erase(i);
+			last[std::this_thread::get_id()] = d;
+
+			return lease(*this, d);
+		}
+		// The single writer connection.
+		lease writer()
+		{
+			std::unique_lock lock(m);
+			checkout(lock, [this] { return !writing; });
+			writing = true;
+
+			return lease(*this, w.get());
+		}
+
+		pool_stats stats()
+		{
+			std::lock_guard lock(m);
+
+			return counters;
+		}
+	};
+
+} // namespace sqlite
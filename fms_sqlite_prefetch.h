@@ -0,0 +1,127 @@
+// fms_sqlite_prefetch.h - step a statement on a producer thread
+#pragma once
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Pipelined cursor. A producer thread owns the statement and fills fixed-size
+	// batches in a single-producer/single-consumer ring while the consumer works
+	// on earlier batches. The producer blocks when the ring is full.
+	// Do not use the statement or its connection until done or cancelled.
+	// sqlite::prefetch p(stmt, 1024, 4);
+	// while (const sqlite::batch* b = p.next()) { ... }
+	class prefetch {
+		stmt& s;
+		size_t rows;               // rows per batch
+		std::vector<batch> slots;  // ring of depth batches
+		std::atomic<size_t> head;  // batches produced
+		std::atomic<size_t> tail;  // batches released by the consumer
+		std::atomic<bool> stop;
+		std::exception_ptr error;  // set by the producer before publishing the last batch
+		bool holding;              // consumer holds slot tail
+		bool finished;
+		std::thread producer;
+
+		// Fill slots until the statement is done, fails, or stop is set.
+		// The last batch published has no rows.
+		void produce() noexcept
+		{
+			const size_t depth = slots.size();
+			for (size_t h = 0; ; ++h) {
+				for (size_t t = tail.load(std::memory_order_acquire); h - t == depth; t = tail.load(std::memory_order_acquire)) {
+					if (stop.load(std::memory_order_acquire)) {
+						return;
+					}
+					tail.wait(t, std::memory_order_acquire);
+				}
+				if (stop.load(std::memory_order_acquire)) {
+					return;
+				}
+
+				batch& b = slots[h % depth];
+				try {
+					s.fetch_batch(b, rows);
+				}
+				catch (...) {
+					error = std::current_exception();
+					b.rows = 0;
+				}
+				head.store(h + 1, std::memory_order_release);
+				head.notify_one();
+				if (b.rows == 0) {
+					return;
+				}
+			}
+		}
+		void join()
+		{
+			if (producer.joinable()) {
+				producer.join();
+			}
+		}
+	public:
+		// depth is the number of batches in flight, at least 2.
+		prefetch(stmt& s, size_t batch_rows = 1024, size_t depth = 4)
+			: s{ s }, rows{ batch_rows ? batch_rows : 1 }, slots(std::max(depth, size_t(2))),
+			head{ 0 }, tail{ 0 }, stop{ false }, holding{ false }, finished{ false }
+		{
+			producer = std::thread(&prefetch::produce, this);
+		}
+		prefetch(const prefetch&) = delete;
+		prefetch& operator=(const prefetch&) = delete;
+		~prefetch()
+		{
+			cancel();
+		}
+
+		// Release the previous batch and wait for the next one.
+		// Returns nullptr when the statement is done. Rethrows producer errors.
+		const batch* next()
+		{
+			if (finished) {
+				return nullptr;
+			}
+
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (holding) {
+				holding = false;
+				tail.store(++t, std::memory_order_release);
+				tail.notify_one();
+			}
+			for (size_t h = head.load(std::memory_order_acquire); h == t; h = head.load(std::memory_order_acquire)) {
+				head.wait(h, std::memory_order_acquire);
+			}
+
+			const batch& b = slots[t % slots.size()];
+			if (b.rows == 0) {
+				finished = true;
+				join();
+				if (error) {
+					std::rethrow_exception(error);
+				}
+
+				return nullptr;
+			}
+			holding = true;
+
+			return &b;
+		}
+
+		// Stop the producer after its current batch and reset the statement.
+		void cancel()
+		{
+			if (producer.joinable()) {
+				stop.store(true, std::memory_order_release);
+				tail.fetch_add(1, std::memory_order_release); // wake a producer waiting on a full ring
+				tail.notify_one();
+				join();
+				s.reset();
+			}
+			finished = true;
+		}
+	};
+
+} // namespace sqlite
@@ -0,0 +1,225 @@
+// fms_sqlite_writer.h - single writer with group commit
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "fms_sqlite.h"
+
+namespace sqlite {
+
+	// Writer counters.
+	struct writer_stats {
+		size_t jobs = 0;
+		size_t failed = 0;         // jobs that threw and were rolled back
+		size_t batches = 0;        // transactions committed or rolled back
+		size_t largest = 0;        // most jobs in one transaction
+		double commit_seconds = 0; // time spent running batches including commit
+
+		double jobs_per_batch() const
+		{
+			return batches ? static_cast<double>(jobs) / batches : 0;
+		}
+	};
+
+	// Owns the only write connection and runs jobs submitted from any thread.
+	// Jobs that arrive within max_delay of the first job of a batch, up to max_batch,
+	// run in one IMMEDIATE transaction. Each job runs in a savepoint so a failing job
+	// is rolled back alone. Futures of jobs that succeed complete after the commit.
+	// sqlite::writer w("a.db");
+	// auto f = w.submit("INSERT INTO t VALUES (?)", 123);
+	// f.get(); // rows changed, or rethrows
+	class writer {
+		struct job {
+			std::function<int(db&)> run;
+			std::promise<int> result;
+		};
+		db d;
+		std::mutex m;
+		std::condition_variable cv;
+		std::deque<job> queue;
+		bool stop = false;
+		size_t batch_max;
+		std::chrono::microseconds delay;
+		writer_stats counters;
+		std::thread worker;
+
+		// Run jobs in one transaction and complete their futures.
+		void commit(std::vector<job>& batch)
+		{
+			const size_t n = batch.size();
+			std::vector<int> value(n);
+			std::vector<bool> done(n, false); // future already completed
+			size_t failed = 0;
+			std::exception_ptr error; // transaction failed
+			const auto t0 = std::chrono::steady_clock::now();
+			try {
+				transact(d, [this, &batch, &value, &done, &failed, n]() {
+					for (size_t i = 0; i < n; ++i) {
+						d.exec("SAVEPOINT job");
+						try {
+							value[i] = batch[i].run(d);
+							d.exec("RELEASE job");
+						}
+						catch (...) {
+							auto job_error = std::current_exception();
+							batch[i].result.set_exception(job_error);
+							done[i] = true;
+							++failed;
+							if (sqlite3_get_autocommit(d)) {
+								// SQLite rolled back the whole transaction, e.g. OR ROLLBACK or SQLITE_FULL
+								std::rethrow_exception(job_error);
+							}
+							d.exec("ROLLBACK TO job");
+							d.exec("RELEASE job");
+						}
+					}
+				}, transaction_mode::immediate);
+			}
+			catch (...) {
+				// BEGIN, SAVEPOINT, ROLLBACK TO, or COMMIT failed
+				error = std::current_exception();
+				for (size_t i = 0; i < n; ++i) {
+					failed += !done[i];
+				}
+			}
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			{
+				std::lock_guard lock(m);
+				counters.jobs += n;
+				counters.failed += failed;
+				++counters.batches;
+				counters.largest = std::max(counters.largest, n);
+				counters.commit_seconds += seconds;
+			}
+
+			for (size_t i = 0; i < n; ++i) {
+				if (done[i]) {
+					continue;
+				}
+				if (error) {
+					batch[i].result.set_exception(error);
+				}
+				else {
+					batch[i].result.set_value(value[i]);
+				}
+			}
+		}
+		void run()
+		{
+			std::vector<job> batch;
+			for (;;) {
+				{
+					std::unique_lock lock(m);
+					cv.wait(lock, [this] { return stop or !queue.empty(); });
+					if (queue.empty()) {
+						return; // stop after draining
+					}
+					// wait for more jobs until the batch is full or the window closes
+					cv.wait_until(lock, std::chrono::steady_clock::now() + delay,
+						[this] { return stop or queue.size() >= batch_max; });
+					const size_t n = std::min(queue.size(), batch_max);
+					for (size_t i = 0; i < n; ++i) {
+						batch.push_back(std::move(queue.front()));
+						queue.pop_front();
+					}
+				}
+				commit(batch);
+				batch.clear();
+			}
+		}
+	public:
+		// Open filename with the default pragmas.
+		explicit writer(const char* filename, size_t max_batch = 256,
+			std::chrono::microseconds max_delay = std::chrono::microseconds(1000))
+			: d(filename), batch_max(max_batch ? max_batch : 1), delay(max_delay)
+		{
+			d.default_pragmas();
+			worker = std::thread(&writer::run, this);
+		}
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+		// Commit queued jobs and join.
+		~writer()
+		{
+			{
+				std::lock_guard lock(m);
+				stop = true;
+			}
+			cv.notify_all();
+			worker.join();
+		}
+
+		// Call f(db&) in the next batch. The future holds its result if it returns int, otherwise 0.
+		template<class F>
+			requires std::invocable<F, db&>
+		std::future<int> submit(F f)
+		{
+			job j;
+			if constexpr (std::is_convertible_v<std::invoke_result_t<F, db&>, int>) {
+				j.run = std::move(f);
+			}
+			else {
+				j.run = [f = std::move(f)](db& d) mutable { f(d); return 0; };
+			}
+			auto result = j.result.get_future();
+			{
+				std::lock_guard lock(m);
+				queue.push_back(std::move(j));
+			}
+			cv.notify_one();
+
+			return result;
+		}
+		// Run one statement with bound parameters in the next batch. The future holds sqlite3_changes.
+		template<class... T>
+		std::future<int> submit(std::string sql, T... ts)
+		{
+			return submit([sql = std::move(sql), params = std::tuple<T...>(std::move(ts)...)](db& d) {
+				auto s = d.cached(sql);
+				s.bind_all(params);
+				s.step();
+
+				return sqlite3_changes(d);
+			});
+		}
+
+		size_t max_batch()
+		{
+			std::lock_guard lock(m);
+
+			return batch_max;
+		}
+		writer& max_batch(size_t n)
+		{
+			std::lock_guard lock(m);
+			batch_max = n ? n : 1;
+
+			return *this;
+		}
+		std::chrono::microseconds max_delay()
+		{
+			std::lock_guard lock(m);
+
+			return delay;
+		}
+		writer& max_delay(std::chrono::microseconds t)
+		{
+			std::lock_guard lock(m);
+			delay = t;
+
+			return *this;
+		}
+
+		writer_stats stats()
+		{
+			std::lock_guard lock(m);
+
+			return counters;
+		}
+	};
+
+} // namespace sqlite